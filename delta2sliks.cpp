@@ -25,16 +25,29 @@
 //                                                                             //
 //  REVISION HISTORY:                                                          //
 //      Version 1.0, 1st Dec 2024 - Initial version                            //
+//      Version 1.1 - Numeric and text characters excluded in-process          //
+//                    (CONFOR no longer required)                              //
+//      Version 1.2 - Optional parse cache directory; data.js is not written   //
+//                    again when the input files are unchanged                 //
+//      Version 1.3 - Items are streamed into data.js (not kept in memory)     //
+//      Version 1.4 - Buffered data.js writer; strings are escaped             //
+//                    Title taken from the parsed directives                   //
+//                    data.js replaced only when completely written            //
 //=============================================================================//
 
 #include <string>
 #include <iostream>
 #include <cctype>
+#include <cstdio>
+#include <cstring>
 #include <algorithm>
 #include "tdelta.h"
 
 using namespace std;
 
+// Version written in data.js, with the key of the input files
+#define D2S_STAMP "// delta2sliks 1.4 - source key "
+
 // Function to remove trailing chars from an string
 std::string trim(const std::string &s) {
     auto start = s.begin();
@@ -62,21 +75,185 @@ std::string parse_attribute(const std::string& input) {
     return "?"; // Return an interrogation mark if no comma or invalid format
 }
 
+// Buffered writer of the SLIKS data file : the output is appended into a
+// large buffer, which is written to the file only when it is full
+// The file is written under a temporary name, then renamed when it is
+// complete : a write error or an interrupted run leaves the previous file.
+class tSliksWriter {
+  public :
+    tSliksWriter(const char *fname, size_t size = 1 << 20);
+    ~tSliksWriter(void)  { discard(); }
+    int is_open(void)  { return out.is_open(); }
+    void put(const char *s, size_t n);
+    void put(const char *s)  { put(s, strlen(s)); }
+    void put(const string & s)  { put(s.data(), s.size()); }
+    // Text of a JavaScript string (between double quotes) : runs of
+    // characters without '"', '\\' or line break are copied at once
+    void put_escaped(const char *s, size_t n);
+    void put_escaped(const string & s)  { put_escaped(s.data(), s.size()); }
+    // Closing and renaming the file
+    //    return value : 1=ok 0=write error (nothing is renamed)
+    int close(void);
+    // Closing without keeping the file
+    void discard(void);
+  protected :
+    string name, tmpname;
+    ofstream out;
+    vector<char> buf;
+    size_t len;
+    int flush(void);
+};
+
+tSliksWriter::tSliksWriter(const char *fname, size_t size)
+	: name(fname), tmpname(string(fname) + ".tmp"), out(tmpname.c_str(), ios::binary), buf(size) {
+	len = 0;
+}
+
+int tSliksWriter::flush(void) {
+	if (len && out.is_open())
+		out.write(buf.data(), len);
+	len = 0;
+	return out.good();
+}
+
+void tSliksWriter::put(const char *s, size_t n) {
+	if (len + n > buf.size()) {
+		flush();
+		if (n > buf.size()) {   // larger than the buffer : written directly
+			out.write(s, n);
+			return;
+		}
+	}
+	memcpy(buf.data() + len, s, n);
+	len += n;
+}
+
+void tSliksWriter::put_escaped(const char *s, size_t n) {
+	const char *end = s + n, *p;
+
+	while (s < end) {
+		p = s;
+		while ((p < end) && (*p != '"') && (*p != '\\') && (*p != '\n') && (*p != '\r'))
+			p++;
+		put(s, p - s);
+		if (p == end)
+			break;
+		put("\\", 1);
+		put((*p == '\n') ? "n" : (*p == '\r') ? "r" : p, 1);
+		s = p + 1;
+	}
+}
+
+int tSliksWriter::close(void) {
+	int ok;
+
+	if (!out.is_open())
+		return 0;
+	ok = flush();
+	out.close();
+	if (!ok || out.fail()) {
+		remove(tmpname.c_str());
+		return 0;
+	}
+	// rename() does not replace an existing file on every system
+	if (rename(tmpname.c_str(), name.c_str()) != 0) {
+		remove(name.c_str());
+		if (rename(tmpname.c_str(), name.c_str()) != 0) {
+			remove(tmpname.c_str());
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void tSliksWriter::discard(void) {
+	if (!out.is_open())
+		return;
+	out.close();
+	remove(tmpname.c_str());
+}
+
+// Writes the items of the data matrix as they are read
+class tItemWriter : public tItemVisitor {
+  public :
+    tItemWriter(tSliksWriter & out) : outfile(out)  { nbitems = 0; }
+    int visit(const tItemView & item);
+    int nbitems;
+  protected :
+    tSliksWriter & outfile;
+    void put_value(const tItemView & item, int attrnum);
+};
+
+int tItemWriter::visit(const tItemView & item) {
+	int nbattr = item.get_attributes_nb();
+
+	// The previous row is ended, as it is not the last one
+	if (nbitems++)
+		outfile.put("],\n");
+	outfile.put("\t[\"");
+	outfile.put_escaped(trim(item.get_item_name(0)));
+	outfile.put("\", ");
+	for (int j = 1; j <= nbattr; j++) {
+		outfile.put("\"");
+		put_value(item, j);
+		outfile.put((j < nbattr) ? "\"," : "\"");
+	}
+	return 1;
+}
+
+// Same value as parse_attribute(item.get_attribute(attrnum)), without
+// formatting the attribute when its comment has no comma
+void tItemWriter::put_value(const tItemView & item, int attrnum) {
+	const tAttrDescr & attr = item.get_attr(attrnum);
+
+	if (attr.get_charcomment().find(',') != string::npos) {
+		outfile.put(parse_attribute(item.get_attribute(attrnum)));
+		return;
+	}
+	string value = attr.get_alternatives();
+	if (std::all_of(value.begin(), value.end(), ::isdigit))
+		outfile.put(value);
+	else
+		outfile.put("?", 1);
+}
+
 // Run this program using the console pauser or add your own getch, system("pause") or input loop 
 int main(int argc, char** argv) {
 	tDelta *Dataset;
+	unsigned long long key = 0;
+	char stamp[80] = "";
   	
   	// Verify filenames arguments
-  	if (argc < 3) {
-    	cout << "Usage : sliks <char_filename> <item_filename> <specs_filename>" << endl;
+  	if (argc < 4) {
+    	cout << "Usage : sliks <char_filename> <item_filename> <specs_filename> [<cache_dir>]" << endl;
     	return 0;
   	}
   	
-  	// Creates CharList, ItemList and Specs objects and parses the corresponding text files 
-  	Dataset = new tDelta(argv[1], argv[2], argv[3]);
+  	// Creates CharList, ItemList and Specs objects
+  	Dataset = new tDelta(argv[1], argv[2], argv[3], 0);
+  	
+  	// With a cache directory, nothing is done if data.js was written from the same files
+  	if (argc > 4) {
+  		Dataset->set_cache(argv[4]);
+  		key = Dataset->get_key();
+  		if (key) {
+  			sprintf(stamp, "%s%016llx", D2S_STAMP, key);
+  			ifstream previous("data.js");
+  			string line;
+  			if (getline(previous, line) && (line == stamp)) {
+  				cout << "data.js is up to date" << endl;
+  				delete Dataset;
+  				return 0;
+  			}
+  		}
+  	}
+  	
+  	// Parses the characters and specifications files (or loads them from the
+  	// cache); items are streamed when data.js is written
+  	Dataset->parse(PARSE_NOW | PARSE_STREAM | PARSE_LAZY);
     	
-    if (!(Dataset->chars->is_parsed() && Dataset->items->is_parsed())) {
-    	cout << "Error parsing characters and/or items description files" << endl;
+    if (!Dataset->chars->is_parsed()) {
+    	cout << "Error parsing characters description file" << endl;
     	delete Dataset;
     	return 1;
   	}
@@ -94,124 +271,75 @@ int main(int argc, char** argv) {
   	
   	cout << "File \"" << Dataset->chars->get_filename() << "\" parsed" << endl;
 	cout << "*** " << Dataset->chars->get_chars_nb() << " characters ***" << endl << endl;
-  	cout << "File \"" << Dataset->items->get_filename() << "\" parsed" << endl;
-	cout << "*** " << Dataset->items->get_items_nb() << " items ***" << endl << endl;
   	if (Dataset->specs)
     	cout << "File \"" << Dataset->specs->get_filename() << "\" parsed" << endl;
+	cout << "*** Parsing time : " << Dataset->get_parse_time() << " s ***" << endl;
     cout << endl;
     
-    // Get title from characters file
-	ifstream infile(Dataset->chars->get_filename()); // Replace with your file's name
-    if (!infile.is_open()) {
-        cout << "Error: Could not open the characters file!" << endl;
-        delete Dataset;
-        return 1;
-    }
-
-    string line;
-    string command = "*SHOW";
-    string title = ""; // Declare outside the loop for broader scope
-    
-	while (getline(infile, line)) {
-        // Check if the line starts with *SHOW
-        if (line.rfind(command, 0) == 0) {
-            // Extract and trim the part after the command
-            title = line.substr(command.length()); // Extract after *COMMENT
-            title = title.empty() ? title : title.substr(1); // Remove leading space
-            cout << "Extracted title: \"" << title << "\"" << endl;
-            break;
-        }
-    }
-    infile.close();
+    // Get title from the *SHOW directive of the characters file
+    string title = Dataset->chars->get_directives().get("SHOW");
+    if (Dataset->chars->get_directives().has("SHOW"))
+        cout << "Extracted title: \"" << title << "\"" << endl;
     
-    // Get numeric and text characters from CharList
-	string excluded = "";
+    // Exclude numeric and text characters from the dataset
+	vector<int> excluded;
     for (int i = 1; i <= Dataset->chars->get_chars_nb(); i++) {  
     	if (Dataset->chars->get_char_type(i) == CT_IN || Dataset->chars->get_char_type(i) == CT_RN || Dataset->chars->get_char_type(i) == CT_TE)
-    		excluded += to_string(i) + " ";
+    		excluded.push_back(i);
 	}
-
-	// Close the original dataset
-	delete Dataset;
-    
-    // Generate CONFOR directives file to exclude numeric and text characters
-    ofstream dirfile;
-    dirfile.open("delchars", ios::out); // Just yet another way of opening a file
-    dirfile << "*SHOW ~ Translate into DELTA format, omitting numeric and text characters\n" << endl;
-    dirfile << "*LISTING FILE delchars.lst\n" << endl;
-    dirfile << "*INPUT FILE " << argv[3] << "\n" << endl;
-    dirfile << "*EXCLUDE CHARACTERS " << excluded << endl << endl;
-    dirfile << "*TRANSLATE INTO DELTA FORMAT\n" << endl;
-    dirfile << "*OUTPUT FILE chars.new" << endl;
-    dirfile << "*OUTPUT PARAMETERS" << endl;
-    dirfile << "#SHOW " << title << endl << endl;
-    dirfile << "#CHARACTER LIST" << endl;
-    dirfile << "*INPUT FILE " << argv[1] << "\n" << endl;
-    dirfile << "*OUTPUT FILE items.new" << endl;
-    dirfile << "*OUTPUT PARAMETERS\n" << endl;
-    dirfile << "#ITEM DESCRIPTIONS" << endl;
-    dirfile << "*INPUT FILE " << argv[2] << "\n";
-    dirfile.close();
-	
-    // Run CONFOR to exclude numeric and text characters
-    #if defined(_WIN32) 
-	int result = system("confor delchars");
-	#elif defined(__linux__)	
-    int result = system("./confor delchars");
-    #endif
-    if (result != 0) {
-        cout << "Error: CONFOR execution failed!" << endl;
-        return 1;
-    }
-    
-    // Open the new trimmed DELTA dataset
-    Dataset = new tDelta("chars.new", "items.new");
-    	
-    if (!(Dataset->chars->is_parsed() && Dataset->items->is_parsed())) {
-    	cout << "Error parsing characters and/or items description files" << endl;
-    	delete Dataset;
-    	return 1;
-  	}
+	Dataset->exclude_characters(excluded);
+	cout << "*** " << excluded.size() << " numeric and text characters excluded ***" << endl << endl;
   
     // Translate into SLIKS format
-    ofstream outfile("data.js");
-    outfile << "var dataset = \"<h2>" << title << "</h2>" << "\"" << endl << endl;
+    tSliksWriter outfile("data.js");
+    if (!outfile.is_open()) {
+    	cout << "Error: Could not create data.js!" << endl;
+    	delete Dataset;
+    	return 1;
+    }
+    if (key) {
+    	outfile.put(stamp);
+    	outfile.put("\n");
+    }
+    outfile.put("var dataset = \"<h2>");
+    outfile.put_escaped(title);
+    outfile.put("</h2>\"\n\n");
     
     // Output characters list
-  	outfile << "var chars = [ [ \"Latin Name\"],"  << endl;
-  	for (int i = 1; i <= Dataset->chars->get_chars_nb(); i++) {  
-        	outfile << "\t[ \"" << Dataset->chars->get_char_feature(i) << "\", ";
-			for (int j = 1; j <= Dataset->chars->get_states_nb(i); j++) {  
-				if (j < Dataset->chars->get_states_nb(i)) 
-					outfile << "\"" << Dataset->chars->get_state(i, j) << "\", ";
-				else
-					outfile << "\"" << Dataset->chars->get_state(i, j) << "\"";
-			} 
-			if (i < Dataset->chars->get_chars_nb())
-				outfile << "],";
-			else
-				outfile << "] ]";	
-			outfile << endl;	
+  	outfile.put("var chars = [ [ \"Latin Name\"],\n");
+  	int nbchars = Dataset->chars->get_chars_nb();
+  	for (int i = 1; i <= nbchars; i++) {  
+  		int nbstates = Dataset->chars->get_states_nb(i);
+		outfile.put("\t[ \"");
+		outfile.put_escaped(Dataset->chars->get_char_feature(i));
+		outfile.put("\", ");
+		for (int j = 1; j <= nbstates; j++) {  
+			outfile.put("\"");
+			outfile.put_escaped(Dataset->chars->get_state(i, j));
+			outfile.put((j < nbstates) ? "\", " : "\"");
+		} 
+		outfile.put((i < nbchars) ? "],\n" : "] ]\n");
 	}
 
-	// Output data matrix
-	outfile << "\n\nvar items = [ [\"\"],\n";
-	for (int i = 1; i <= Dataset->items->get_items_nb(); i++) {
-        outfile << "\t[\"" << trim(Dataset->items->get_item_name(i, 0)) << "\", ";
-        for (int j = 1; j <= Dataset->items->get_attributes_nb(i); j++) {        		
-        	if (j < Dataset->items->get_attributes_nb(i))
-            	outfile << "\"" << parse_attribute(Dataset->items->get_attribute(i, j)) << "\",";
-            else
-				outfile << "\"" << parse_attribute(Dataset->items->get_attribute(i, j)) << "\"";
-    	}
-        if (i < Dataset->items->get_items_nb())    
-        	outfile << "],";
-        else
-			outfile << "]";
-		outfile << endl;	
+	// Output data matrix (items are read from the file as they are written)
+	outfile.put("\n\nvar items = [ [\"\"],\n");
+	tItemWriter writer(outfile);
+	if (Dataset->stream_items(writer) < 0) {
+		cout << "Error parsing items description file" << endl;
+		outfile.discard();
+		delete Dataset;
+		return 1;
 	}
+	if (writer.nbitems)
+		outfile.put("]\n");
 
-	outfile.close();  	
+	if (!outfile.close()) {
+		cout << "Error writing data.js" << endl;
+		delete Dataset;
+		return 1;
+	}
+  	cout << "File \"" << Dataset->items->get_filename() << "\" streamed" << endl;
+	cout << "*** " << writer.nbitems << " items ***" << endl << endl;
   	delete Dataset;	
 	return 0;
 }
@@ -24,55 +24,609 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
 #include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <charconv>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TDELTA_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Vectorized scanning (can be disabled with -DTDELTA_NO_SIMD)
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(TDELTA_NO_SIMD)
+#define TDELTA_SIMD
+#include <immintrin.h>
+#endif
 
 #include "tdelta.h"
 
+// Search of the first byte equal to a, b or c in the span [p, end[
+// (end if none). The bytes are compared 16 at a time (SSE2), or 32 at a time
+// (AVX2) in long spans when the processor allows it; the remainder of the
+// span is scanned byte by byte.
+#ifdef TDELTA_SIMD
+__attribute__((target("avx2")))
+static const char *scan_bytes_avx2(const char *p, const char *end, char a, char b, char c)
+{
+  __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b), vc = _mm256_set1_epi8(c);
+  __m256i x;
+  unsigned mask;
+
+  while (end - p >= 32) {
+    x = _mm256_loadu_si256((const __m256i *) p);
+    mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, va),
+                                _mm256_cmpeq_epi8(x, vb)), _mm256_cmpeq_epi8(x, vc)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 32;
+  }
+  return p;
+}
+
+// Resolved at the first long span (not during the static initialization,
+// where the CPU model may not be initialized yet)
+static int has_avx2(void)
+{
+  static const int avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2"));
+
+  return avx2;
+}
+#endif
+
+static inline const char *scan_bytes(const char *p, const char *end, char a,
+                                     char b, char c)
+{
+#ifdef TDELTA_SIMD
+  __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b), vc = _mm_set1_epi8(c);
+  __m128i x;
+  int mask;
+
+  while (end - p >= 16) {
+    x = _mm_loadu_si128((const __m128i *) p);
+    mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, va),
+                             _mm_cmpeq_epi8(x, vb)), _mm_cmpeq_epi8(x, vc)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 16;
+    if ((end - p >= 128) && has_avx2()) {   // long span
+      p = scan_bytes_avx2(p, end, a, b, c);
+      if ((p < end) && ((*p == a) || (*p == b) || (*p == c)))
+        return p;  // found
+    }
+  }
+#endif
+  while ((p < end) && (*p != a) && (*p != b) && (*p != c))
+    p++;
+  return p;
+}
+
+static inline const char *scan_bytes(const char *p, const char *end, char a)
+{
+  return scan_bytes(p, end, a, a, a);
+}
+
+// Conversion of a string span into an integer (same as atoi(), without
+// reading beyond the end of the span)
+static int span_atoi(const char *p, const char *end)
+{
+  int n = 0, neg = 0;
+
+  while ((p < end) && ((*p==' ')||(*p=='\t')))
+    p++;
+  if ((p < end) && ((*p=='-')||(*p=='+')))
+    neg = (*p++ == '-');
+  while ((p < end) && (*p>='0' && *p<='9'))
+    n = n*10 + (*p++ - '0');
+  return neg ? -n : n;
+}
+
+// Conversion of the number at the beginning of a string span into a double
+// (same as atof(), without reading beyond the end of the span and whatever
+// the locale); returns the position after the number (p if none, x=0)
+static const char *span_atof(const char *p, const char *end, double & x)
+{
+  const char *q = p;
+  from_chars_result r;
+
+  if ((q < end) && (*q == '+')) {  // sign accepted by atof, not by from_chars
+    q++;
+    if ((q < end) && (*q == '-')) {
+      x = 0;
+      return p;
+    }
+  }
+  r = from_chars(q, end, x);
+  if (r.ec == errc::invalid_argument) {
+    x = 0;
+    return p;
+  }
+  if (r.ec == errc::result_out_of_range)   // overflow or underflow
+    x = strtod(string(q, r.ptr).c_str(), NULL);
+  return r.ptr;
+}
+
 
 //===== tDeltaFile ========================================================
 
-//----- Reads the next line from the file ---------------------------------
+// Constructors
+tDeltaFile::tDeltaFile(const char * _name) : tTextFile(_name)
+{
+  lines_nb = 0;
+  use_map = 1;
+  in_memory = 0;
+  release = 0;
+  map_addr = NULL;
+  map_size = 0;
+  map_begin = map_pos = map_end = map_released = NULL;
+}
+
+tDeltaFile::tDeltaFile(const char * _name, const char *begin, const char *end)
+  : tTextFile(_name)
+{
+  lines_nb = 0;
+  use_map = 1;
+  in_memory = 1;
+  release = 0;
+  map_addr = NULL;  // the block is not owned
+  map_size = 0;
+  map_begin = map_pos = map_released = begin;
+  map_end = end;
+}
+
+//----- Opens the file (mapping it in read access mode) -------------------
+int tDeltaFile::open(const unsigned access_mode)
+{
+  close();
+  lines_nb = 0;
+#ifdef TDELTA_MMAP
+  struct stat st;
+  int fd;
+  void *addr;
+
+  if ((access_mode == AM_READ) && use_map) {
+    fd = ::open(name, O_RDONLY);
+    if (fd < 0)
+      return 0;
+    if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0)) {
+      addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED) {
+        ::close(fd);
+        madvise(addr, st.st_size, MADV_SEQUENTIAL);
+        in_memory = 1;
+        map_addr = addr;
+        map_size = st.st_size;
+        map_begin = map_pos = map_released = (const char *) addr;
+        map_end = map_pos + map_size;
+        return 1;
+      }
+    }
+    ::close(fd);  // empty or special file, or mapping failure --> buffered reading
+  }
+#endif
+  return tTextFile::open(access_mode);
+}
+
+//----- Closes the file ---------------------------------------------------
+int tDeltaFile::close(void)
+{
+  if (in_memory) {
+#ifdef TDELTA_MMAP
+    if (map_addr)
+      munmap(map_addr, map_size);
+#endif
+    in_memory = 0;
+    map_addr = NULL;
+    map_size = 0;
+    map_begin = map_pos = map_end = map_released = NULL;
+    return 1;
+  }
+  return tFile::close();
+}
+
+//----- Test if end of file is reached ------------------------------------
+int tDeltaFile::eof(void)
+{
+  if (in_memory)
+    return (map_pos >= map_end);
+  return tFile::eof();
+}
+
+//----- Reads the next line from the file (copy into dest) ----------------
 int tDeltaFile::next_line(char *dest, const int lmax)
 {
-  char *p0, *p1;
+  const char *line, *eol;
+  int n;
+
+  if (!next_line(line, eol))
+    return 0;    // return eof or error
+  n = eol - line;
+  if (n > lmax-1)
+    n = lmax-1;  // truncated line
+  memcpy(dest, line, n);
+  dest[n] = '\x00';
+  return 1;      // return ok (next valid line in dest)
+}
+
+//----- Reads the next line from the file (span) --------------------------
+int tDeltaFile::next_line(const char * & line, const char * & eol)
+{
+  const char *p1, *p2;
 
   while (1) {
-    if (read_line(dest, lmax)) {
-      lines_nb++;
-      p0 = p1 = dest;
-      // deletes blanks and tabs at the begin of the line
-      while ((*p1==' ')||(*p1=='\t'))
-        p1++;
-      while (*p1) {
-        *p0 = *p1;
-        p0++; p1++;
+    if (in_memory) {
+      //--- Mapped file : the line is located into the mapping
+      if (map_pos >= map_end)
+        return 0;  // return eof
+      p1 = map_pos;
+#ifdef TDELTA_MMAP
+      //--- Release of the pages read (by steps of 8 MB)
+      if (release && map_addr && (p1 - map_released >= (8L << 20))) {
+        long page = sysconf(_SC_PAGESIZE);
+        const char *p3 = map_begin + (p1 - map_begin) / page * page;
+        madvise((void *) map_released, p3 - map_released, MADV_DONTNEED);
+        map_released = p3;
       }
-      *p0 = '\x00';
-      if (*dest)
-        return 1;  // return ok (next valid line in dest)
+#endif
+      p2 = (const char *) memchr(p1, '\n', map_end - p1);
+      if (p2)
+        map_pos = p2 + 1;
+      else
+        map_pos = p2 = map_end;  // last line without EOL
+    }
+    else {
+      //--- Buffered reading
+      fs.clear();
+      if (!getline(fs, lbuf))
+        return 0;  // return eof or error
+      p1 = lbuf.data();
+      p2 = p1 + lbuf.size();
+    }
+    lines_nb++;
+    if ((p2 > p1) && (*(p2-1) == '\r'))  // CRLF line delimitation
+      p2--;
+    // skips blanks and tabs at the begin of the line
+    while ((p1 < p2) && ((*p1==' ')||(*p1=='\t')))
+      p1++;
+    if (p1 < p2) {
+      line = p1;
+      eol = p2;
+      return 1;  // return ok (next valid line)
     }
-    else
-      return 0;    // return eof or error
   }  // while
 }
 
 
+//===== tParseCache =======================================================
+
+//----- Hash of a memory block (64 bits FNV-1a) ---------------------------
+unsigned long long tParseCache::hash(const char *data, long size, unsigned long long h)
+{
+  const unsigned char *p, *end;
+
+  p = (const unsigned char *) data;
+  end = p + size;
+  while (p < end) {
+    h ^= *p++;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+//----- Key of a file : hash of the library version, kind and contents ----
+unsigned long long tParseCache::file_key(const char *fname, const char *kind)
+{
+  tDeltaFile f(fname);
+  unsigned long long h;
+  char version[32];
+
+  if (!f.open(AM_READ))
+    return 0;
+  if (!f.is_mapped()) {
+    f.close();
+    return 0;
+  }
+  sprintf(version, "%s/%d/", TDELTA_VERSION, PARSE_CACHE_VERSION);
+  h = hash(version, strlen(version));
+  h = hash(kind, strlen(kind)+1, h);
+  h = hash(f.get_data(), f.get_data_end() - f.get_data(), h);
+  f.close();
+  return h ? h : 1;  // 0 = no key
+}
+
+//----- Name of the entry file of a key -----------------------------------
+string tParseCache::entry_name(const string & dir, unsigned long long key)
+{
+  char name[32];
+
+  sprintf(name, "/%016llx.tdc", key);
+  return dir + name;
+}
+
+//----- Writing values ----------------------------------------------------
+void tParseCache::put_int(int n)
+{
+  data.append((const char *) &n, sizeof(n));
+}
+
+void tParseCache::put_double(double x)
+{
+  data.append((const char *) &x, sizeof(x));
+}
+
+void tParseCache::put_string(const string & s)
+{
+  put_int(s.size());
+  data.append(s);
+}
+
+void tParseCache::put_string(const pmr::string & s)
+{
+  put_int(s.size());
+  data.append(s.data(), s.size());
+}
+
+//----- Stores the written values under a key -----------------------------
+//        The entry is written in a temporary file and then renamed, so that
+//        a reader never gets an incomplete entry
+int tParseCache::store(const string & dir, unsigned long long key)
+{
+  string name, tmp;
+  FILE *f;
+  int ok;
+
+  name = entry_name(dir, key);
+  tmp = name + ".tmp";
+  f = fopen(tmp.c_str(), "wb");
+  if (!f) {
+    cerr << "Unable to create " << tmp << endl;
+    return 0;
+  }
+  ok = (fwrite(&key, sizeof(key), 1, f) == 1);
+  if (ok && data.size())
+    ok = (fwrite(data.data(), data.size(), 1, f) == 1);
+  if (fclose(f) || !ok) {
+    cerr << "Error writing " << tmp << endl;
+    remove(tmp.c_str());
+    return 0;
+  }
+  if (rename(tmp.c_str(), name.c_str())) {
+    remove(name.c_str());  // existing entry (systems without atomic renaming)
+    if (rename(tmp.c_str(), name.c_str())) {
+      remove(tmp.c_str());
+      return 0;
+    }
+  }
+  return 1;
+}
+
+//----- Loads the entry of a key ------------------------------------------
+int tParseCache::load(const string & dir, unsigned long long key)
+{
+  unsigned long long k;
+  string name;
+  FILE *f;
+  long size;
+  int ok;
+
+  pos = end = NULL;
+  bad = 1;
+  name = entry_name(dir, key);
+  f = fopen(name.c_str(), "rb");
+  if (!f)
+    return 0;
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  ok = (size >= (long) sizeof(k)) && (fread(&k, sizeof(k), 1, f) == 1) && (k == key);
+  if (ok) {
+    data.resize(size - sizeof(k));
+    ok = data.empty() || (fread(&data[0], data.size(), 1, f) == 1);
+  }
+  fclose(f);
+  if (!ok) {
+    data.clear();
+    return 0;
+  }
+  pos = data.data();
+  end = pos + data.size();
+  bad = 0;
+  return 1;
+}
+
+//----- Reading values ----------------------------------------------------
+//        Reading beyond the end of the entry gives 0 (see is_complete())
+int tParseCache::get_int(void)
+{
+  int n = 0;
+
+  if (!bad && (end - pos >= (long) sizeof(n))) {
+    memcpy(&n, pos, sizeof(n));
+    pos += sizeof(n);
+  }
+  else
+    bad = 1;
+  return n;
+}
+
+double tParseCache::get_double(void)
+{
+  double x = 0;
+
+  if (!bad && (end - pos >= (long) sizeof(x))) {
+    memcpy(&x, pos, sizeof(x));
+    pos += sizeof(x);
+  }
+  else
+    bad = 1;
+  return x;
+}
+
+void tParseCache::get_string(string & s)
+{
+  int n;
+
+  n = get_count();
+  if (n < 0) {
+    s.clear();
+    return;
+  }
+  s.assign(pos, n);
+  pos += n;
+}
+
+void tParseCache::get_string(pmr::string & s)
+{
+  int n;
+
+  n = get_count();
+  if (n < 0) {
+    s.clear();
+    return;
+  }
+  s.assign(pos, n);
+  pos += n;
+}
+
+int tParseCache::get_count(void)
+{
+  int n;
+
+  n = get_int();
+  if (bad || (n < 0) || (n > end - pos)) {
+    bad = 1;  // invalid entry
+    return -1;
+  }
+  return n;
+}
+
+
+//===== tDirectiveTable ===================================================
+
+// Known directive names (CONFOR and KEY directives of the chars, items and
+// specs files)
+static const char * const directive_names[] = {
+  "SHOW", "COMMENT", "LISTING FILE", "PRINT FILE", "OUTPUT FILE",
+  "CHARACTER LIST", "ITEM DESCRIPTIONS", "CHARACTER NOTES", "CHARACTER IMAGES",
+  "NUMBER OF CHARACTERS", "MAXIMUM NUMBER OF STATES", "MAXIMUM NUMBER OF ITEMS",
+  "CHARACTER TYPES", "NUMBERS OF STATES", "IMPLICIT VALUES",
+  "DEPENDENT CHARACTERS", "MANDATORY CHARACTERS", "CHARACTER RELIABILITIES",
+  "CHARACTER WEIGHTS", "DATA BUFFER SIZE", "NUMBERS OF DECIMAL PLACES",
+  "KEY STATES", "ITEM ABUNDANCES", NULL
+};
+
+// Test if [p, p+n[ is the name (upper case), ignoring case
+static int same_name(const char *p, const char *name, int n)
+{
+  for (int i=0; i<n; i++)
+    if (toupper((unsigned char) p[i]) != name[i])
+      return 0;
+  return 1;
+}
+
+//----- Adds a directive ---------------------------------------------------
+const string & tDirectiveTable::add(const char *line, const char *eol)
+{
+  const char *p, *q, *name;
+  int i, n, len;
+  string key;
+
+  p = line;
+  if ((p < eol) && (*p == '*'))
+    p++;
+  //--- Longest known name
+  len = 0;
+  for (i=0; directive_names[i]; i++) {
+    name = directive_names[i];
+    n = strlen(name);
+    if ((n <= len) || (eol - p < n) || !same_name(p, name, n))
+      continue;
+    if ((p + n < eol) && isalnum((unsigned char) p[n]))
+      continue;  // longer word (e.g. "SHOWING")
+    len = n;
+  }
+  //--- Otherwise the first word
+  if (!len) {
+    for (q=p; (q < eol) && (*q != ' ') && (*q != '\t'); q++)
+      ;
+    len = q - p;
+  }
+  key.assign(p, len);
+  for (i=0; i<key.size(); i++)
+    key[i] = toupper((unsigned char) key[i]);
+  //--- Value : one blank removed
+  p += len;
+  if ((p < eol) && ((*p == ' ') || (*p == '\t')))
+    p++;
+  return table.emplace(key, string(p, eol)).first->first;
+}
+
+void tDirectiveTable::add(const vector<string> & lines)
+{
+  for (int i=0; i<lines.size(); i++)
+    add(lines[i].data(), lines[i].data() + lines[i].size());
+}
+
+//----- Lookup -------------------------------------------------------------
+string tDirectiveTable::get(const char *name) const
+{
+  map<string, string>::const_iterator it = table.find(name);
+
+  return (it != table.end()) ? it->second : string();
+}
+
+int tDirectiveTable::get_int(const char *name) const
+{
+  map<string, string>::const_iterator it = table.find(name);
+  const char *p;
+  char *end;
+  long n;
+
+  if (it == table.end())
+    return 0;
+  p = it->second.c_str();
+  n = strtol(p, &end, 10);
+  if ((end == p) || (n < 0) || (n > INT_MAX))
+    return 0;
+  return n;
+}
+
+
 //===== tDelta ============================================================
 
+//----- Size of a file in bytes (0 if unknown, e.g. a pipe) -------------------
+static long file_size(const char *fname)
+{
+  FILE *f;
+  long size;
+
+  if (!fname || !*fname || !(f = fopen(fname, "rb")))
+    return 0;
+  size = (fseek(f, 0, SEEK_END) == 0) ? ftell(f) : 0;
+  fclose(f);
+  return (size > 0) ? size : 0;
+}
+
 // Constructors
 tDelta::tDelta(const char *chars_fname, const char *items_fname, int parse)
 {
-  chars = new tDeltaCharList(chars_fname, parse);
-  items = new tDeltaItemList(items_fname, parse);
-  specs = NULL;
+  load(chars_fname, items_fname, NULL, parse);
 }
 
 tDelta::tDelta(const char *chars_fname, const char *items_fname,
                const char *specs_fname, int parse)
 {
-  chars = new tDeltaCharList(chars_fname, parse);
-  items = new tDeltaItemList(items_fname, parse);
-  specs = new tDeltaSpecs(specs_fname, chars, items, parse);
+  load(chars_fname, items_fname, specs_fname, parse);
 }
 
 // Destructor
@@ -86,15 +640,212 @@ tDelta::~tDelta(void)
     delete chars;
 }
 
+//----- Creates and parses the characters, items and specifications lists ----
+void tDelta::load(const char *chars_fname, const char *items_fname,
+                  const char *specs_fname, int parse)
+{
+  chars = new tDeltaCharList(chars_fname, 0);
+  items = new tDeltaItemList(items_fname, 0);
+  specs = specs_fname ? new tDeltaSpecs(specs_fname, chars, items, 0) : NULL;
+  parse_time = 0;
+  if (parse)
+    this->parse(parse);
+}
+
+//----- Parses the characters, items and specifications lists ------------------
+int tDelta::parse(int options)
+{
+  chrono::steady_clock::time_point t0;
+
+  if (!chars || !items)
+    return 0;
+  t0 = chrono::steady_clock::now();
+  if (options & PARSE_PARALLEL)
+    items->set_threads(0);
+  if (options & PARSE_ARENA)
+    items->set_arena(1);
+  if (options & PARSE_LAZY)
+    items->set_lazy(1);
+  //--- Declared sizes from the specifications, to pre-size the lists
+  //    (each character takes at least 4 bytes of the characters file)
+  if (specs && specs->read_specs()) {
+    vector<int> nbstates;
+    long n = file_size(chars->get_filename()) / 4;
+    specs->get_declared_states(nbstates, (n > INT_MAX) ? INT_MAX : (int) n);
+    chars->set_declared_sizes(specs->get_declared_chars_nb(), nbstates);
+    items->set_declared_items(specs->get_declared_items_nb());
+  }
+  if (options & PARSE_STREAM) {
+    //--- Items are read later (see stream_items)
+    if (chars->parse_characters() && specs)
+      specs->parse_specs();
+  }
+  else if (options & PARSE_CONCURRENT) {
+    //--- Items parsed on a separate thread; specifications are parsed
+    //    after characters, since they refer to the characters list
+    thread titems(&tDeltaItemList::parse_items, items);
+    if (chars->parse_characters() && specs)
+      specs->parse_specs();
+    titems.join();
+  }
+  else {
+    chars->parse_characters();
+    items->parse_items();
+    if (specs && chars->is_parsed())
+      specs->parse_specs();
+  }
+  //--- Identification indexes (need character types from specifications)
+  if ((options & PARSE_INDEX) && chars->is_parsed() && items->is_parsed())
+    items->build_indexes(chars);
+  if ((options & PARSE_MATRIX) && chars->is_parsed() && items->is_parsed())
+    items->build_matrix(chars);
+  parse_time = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+  return chars->is_parsed() && ((options & PARSE_STREAM) || items->is_parsed())
+         && (!specs || specs->is_parsed());
+}
+
+//----- Parse cache directory -------------------------------------------------
+void tDelta::set_cache(const char *dir)
+{
+  if (chars)
+    chars->set_cache(dir);
+  if (items)
+    items->set_cache(dir);
+  if (specs)
+    specs->set_cache(dir);
+}
+
+//----- Key of the dataset files contents -------------------------------------
+unsigned long long tDelta::get_key(void)
+{
+  unsigned long long key[3];
+  int i, n;
+
+  if (!chars || !items)
+    return 0;
+  n = 0;
+  key[n++] = tParseCache::file_key(chars->get_filename(), "chars");
+  key[n++] = tParseCache::file_key(items->get_filename(), "items");
+  if (specs)
+    key[n++] = tParseCache::file_key(specs->get_filename(), "specs");
+  for (i=0; i<n; i++)
+    if (!key[i])
+      return 0;
+  return tParseCache::hash((const char *) key, n * sizeof(key[0]));
+}
+
+//----- Saves the parsed dataset as a binary snapshot -------------------------
+int tDelta::save_snapshot(const char *fname)
+{
+  return tDeltaSnapshot::save(*this, fname);
+}
+
+//----- Excludes characters from the whole dataset ----------------------------
+int tDelta::exclude_characters(const vector<int> &excluded)
+{
+  vector<int> charmap;
+  int i, n, nb, indexed, matrix;
+
+  if (!chars)
+    return 0;
+  indexed = matrix = 0;
+  //--- Builds the renumbering table (charmap[old number] = new number)
+  n = chars->get_chars_nb();
+  charmap.assign(n+1, 1);
+  charmap[0] = 0;
+  for (i=0; i<excluded.size(); i++)
+    if ((excluded[i] >= 1) && (excluded[i] <= n))
+      charmap[excluded[i]] = 0;
+  nb = 0;
+  for (i=1; i<=n; i++)
+    if (charmap[i])
+      charmap[i] = ++nb;
+  //--- Renumbers specifications first (they refer to the characters list)
+  if (specs)
+    specs->renumber_characters(charmap);
+  if (items) {
+    indexed = items->is_indexed();
+    matrix = items->get_matrix().is_built();
+    items->renumber_characters(charmap);
+  }
+  chars->renumber_characters(charmap);
+  //--- Renumbering from the file numbers, for the streamed items
+  if (file_charmap.empty())
+    file_charmap = charmap;
+  else
+    for (i=1; i<file_charmap.size(); i++)
+      file_charmap[i] = charmap[file_charmap[i]];
+  if (indexed)
+    items->build_indexes(chars);
+  if (matrix)
+    items->build_matrix(chars);
+  return nb;
+}
+
+
+//----- Streaming of the items file ------------------------------------------
+int tDelta::stream_items(tItemVisitor & visitor)
+{
+  if (!items)
+    return -1;
+  return items->stream_items(visitor, file_charmap.empty() ? NULL : &file_charmap);
+}
+
+//----- Identification taking the character dependencies into account -------
+int tDelta::identify(const tSpecimen & specimen, tItemSet & result, int strict,
+                     int with_extrval, tItemSet *inapplicable)
+{
+  tItemSet ia;
+
+  if (!items)
+    return 0;
+  if (!specs || !specs->is_parsed()) {
+    if (inapplicable)
+      inapplicable->resize(chars ? chars->get_chars_nb() : 0);
+    return items->identify(specimen, result, strict, with_extrval);
+  }
+  specs->inapplicable_chars(specimen, ia);
+  if (inapplicable)
+    *inapplicable = ia;
+  return items->identify(specimen, ia, result, strict, with_extrval);
+}
+
+int tDelta::identify(const vector<tSpecimen> & specimens, vector<tItemSet> & results,
+                     int strict, int with_extrval)
+{
+  vector<tItemSet> ia;
+  int i;
+
+  if (!items)
+    return 0;
+  if (!specs || !specs->is_parsed())
+    return items->identify(specimens, results, strict, with_extrval);
+  ia.resize(specimens.size());
+  for (i=0; i<specimens.size(); i++)
+    specs->inapplicable_chars(specimens[i], ia[i]);
+  return items->identify(specimens, ia, results, strict, with_extrval);
+}
+
 
 //===== tDeltaCharList ====================================================
 
+//----- Declared number of elements, if plausible -----------------------------
+//        Each element takes at least 'minsize' bytes of the file. The size of
+//        a file which is not mapped is unknown (return value 0=not plausible)
+static int plausible_count(int n, tDeltaFile *f, int minsize)
+{
+  if ((n <= 0) || !f->is_mapped())
+    return 0;
+  return (n <= (f->get_data_end() - f->get_data()) / minsize) ? n : 0;
+}
+
 // Constructors
 
 tDeltaCharList::tDeltaCharList(void)
 {
   fchars = NULL;
   nbchars = 0;
+  decl_chars = 0;
   parsed = 0;
 }
 
@@ -102,6 +853,7 @@ tDeltaCharList::tDeltaCharList(const char *fname, int parse)
 {
   fchars = new tDeltaFile(fname);
   nbchars = 0;
+  decl_chars = 0;
   parsed = 0;
   if (parse)
     parse_characters();
@@ -114,9 +866,9 @@ tDeltaCharList::tDeltaCharList(const char *fname, int parse)
 //----- Parse the character file ----------------------------------------------
 int tDeltaCharList::parse_characters(void)
 {
-  char cline[LMAXLINE];
-  char *p1;
-  int ok, nbstates;
+  const char *p1, *eol;
+  unsigned long long key;
+  int ok, nbstates, n;
 
   //--- Test if character file exist ---
   if (!fchars)
@@ -125,19 +877,34 @@ int tDeltaCharList::parse_characters(void)
   if (parsed) {
     char_list.erase(char_list.begin(), char_list.end());
     directives.erase(directives.begin(), directives.end());
+    dir_table.clear();
+  }
+  //--- Parsed form in the cache ---
+  key = 0;
+  if (cache_dir.size() && (key = tParseCache::file_key(fchars->get_name(), "chars"))) {
+    tParseCache cache;
+    if (cache.load(cache_dir, key) && load_cache(cache)) {
+      parsed = 1;
+      return 1;
+    }
   }
   //--- Open the file ---
   if (!fchars->open(AM_READ)) {
     cerr << "Unable to open " << fchars->get_name() << endl;
     return 0;
   }
+  //--- Pre-sizing from the declared sizes ---
+  char_list.reserve(plausible_count(decl_chars, fchars, 4));
+  n = decl_states.size() ? *max_element(decl_states.begin(), decl_states.end()) : 0;
+  if (n && !plausible_count(n, fchars, 4))
+    decl_states.clear();
   ok = 1;
-  p1 = NULL;
+  p1 = eol = NULL;
   //--- Reading loop ---
   while (ok) {
-    if ((p1==NULL) || (!*p1)) {
+    if (p1 == eol) {
       //--- Extract next line from character file ---
-      ok = fchars->next_line(cline);
+      ok = fchars->next_line(p1, eol);
       if (!ok) {
         //--- End of file or error ---
         if (!fchars->eof()) {
@@ -145,50 +912,105 @@ int tDeltaCharList::parse_characters(void)
           return 0;
         }
         if (nbchars)   // at least one character is already read
-          char_list.push_back(cd);  // Store the last character read
+          char_list.push_back(move(cd));  // Store the last character read
+        fchars->close();
         //retrieve_all();  //debug
+        if (key) {
+          tParseCache cache;
+          save_cache(cache);
+          cache.store(cache_dir, key);
+        }
         //--- End parsing ---
 	parsed = 1;
         return 1;
       }
-      p1 = cline;
     }
     //--- Processing the line ---
     if (*p1 == '*')
       //--- Reading a directive ---
-      ok = read_directive(cline, p1);
+      ok = read_directive(p1, eol);
     else 
       if (*p1 == '#') {
         //--- Reading a character ---
         nbstates = 0;
         // Before reading the next character, we store the current one
         if (nbchars) {  // at least one character is already read
-          char_list.push_back(cd);
-          cd.states.erase(cd.states.begin(), cd.states.end());  // reinit state list
+          char_list.push_back(move(cd));
+          cd.states.clear();  // reinit state list (moved-from)
         }
-        ok = read_character(cline, p1);
+        ok = read_character(p1, eol);
       }
       else
         //--- Reading a character state ---
-        ok = read_state(cline, p1, nbstates);
+        ok = read_state(p1, eol, nbstates);
   }
   return 0;
 }
 
-//----- Set or change the character list filename -----------------------------
-void tDeltaCharList::set_filename(const char *fname, int parse)
+//----- Storing the parsed characters in the parse cache -----------------------
+void tDeltaCharList::save_cache(tParseCache & cache)
 {
-  if (fchars)
-    delete fchars;
-  fchars = new tDeltaFile(fname);
-  nbchars = 0;
-  parsed = 0;
-  if (parse)
-    parse_characters();
+  int i, j;
+
+  cache.put_int(directives.size());
+  for (i=0; i<directives.size(); i++)
+    cache.put_string(directives[i]);
+  cache.put_int(char_list.size());
+  for (i=0; i<char_list.size(); i++) {
+    cache.put_string(char_list[i].feature);
+    cache.put_string(char_list[i].unit);
+    cache.put_int(char_list[i].char_type);
+    cache.put_int(char_list[i].states.size());
+    for (j=0; j<char_list[i].states.size(); j++)
+      cache.put_string(char_list[i].states[j]);
+  }
 }
 
-//----- Retrieves the character list filename ---------------------------------
-const char *tDeltaCharList::get_filename(void)
+//----- Loading the characters from the parse cache ----------------------------
+//        return value : 1=ok 0=invalid entry (nothing loaded)
+int tDeltaCharList::load_cache(tParseCache & cache)
+{
+  int i, j, n;
+
+  n = cache.get_count();
+  directives.resize(n > 0 ? n : 0);
+  for (i=0; i<directives.size(); i++)
+    cache.get_string(directives[i]);
+  n = cache.get_count();
+  char_list.resize(n > 0 ? n : 0);
+  for (i=0; i<char_list.size(); i++) {
+    cache.get_string(char_list[i].feature);
+    cache.get_string(char_list[i].unit);
+    char_list[i].char_type = cache.get_int();
+    n = cache.get_count();
+    char_list[i].states.resize(n > 0 ? n : 0);
+    for (j=0; j<char_list[i].states.size(); j++)
+      cache.get_string(char_list[i].states[j]);
+  }
+  if (!cache.is_complete()) {
+    char_list.clear();
+    directives.clear();
+    return 0;
+  }
+  dir_table.add(directives);
+  nbchars = char_list.size();
+  return 1;
+}
+
+//----- Set or change the character list filename -----------------------------
+void tDeltaCharList::set_filename(const char *fname, int parse)
+{
+  if (fchars)
+    delete fchars;
+  fchars = new tDeltaFile(fname);
+  nbchars = 0;
+  parsed = 0;
+  if (parse)
+    parse_characters();
+}
+
+//----- Retrieves the character list filename ---------------------------------
+const char *tDeltaCharList::get_filename(void)
 {
   if (fchars)
     return fchars->get_name();
@@ -261,6 +1083,22 @@ string tDeltaCharList::get_state(int charnum, int statenum)
     return "";
 }
 
+//----- Removes excluded characters and renumbers the remaining ones ----------
+void tDeltaCharList::renumber_characters(const vector<int> &charmap)
+{
+  int i, j, n;
+
+  n = char_list.size();
+  for (i=0, j=0; i<n; i++)
+    if (((i+1) < charmap.size()) && charmap[i+1]) {
+      if (i != j)
+        char_list[j] = char_list[i];
+      j++;
+    }
+  char_list.erase(char_list.begin()+j, char_list.end());
+  nbchars = j;
+}
+
 //----- For debuging
 void tDeltaCharList::retrieve_all(void)
 {
@@ -288,23 +1126,23 @@ void tDeltaCharList::retrieve_all(void)
 // Private member functions
 
 //----- Reads one directive ---------------------------------------------------
-int tDeltaCharList::read_directive(char *cline, char * & p1)
+int tDeltaCharList::read_directive(const char * & p1, const char * & eol)
 {
-  directives.push_back(cline);
-  p1 += strlen(cline);  // moves p1 at end of line
+  directives.push_back(string(p1, eol));
+  dir_table.add(p1, eol);
+  p1 = eol;  // moves p1 at end of line
   return 1;
 }
 
 //----- Reads the feature of a character --------------------------------------
-int tDeltaCharList::read_character(char *cline, char * & p1)
+int tDeltaCharList::read_character(const char * & p1, const char * & eol)
 {
-  char buf[BUFSIZE];
-  char *p2;;
+  const char *p2;
   int n, stop;
 
   //--- Extract and verify the character number ---
   p1++;
-  n = atoi(p1);
+  n = span_atoi(p1, eol);
   if (n != nbchars+1) {
     cerr << "Parse error line " << fchars->get_lines_nb() << " : character sequence break" << endl;
     return 0;
@@ -312,55 +1150,54 @@ int tDeltaCharList::read_character(char *cline, char * & p1)
   nbchars++;
   //----- Extract feature description -----
   // Skip at begin of character description
-  while ((*p1>='0' && *p1<='9') || (*p1=='.') || (*p1==' '))
+  while ((p1 < eol) && ((*p1>='0' && *p1<='9') || (*p1=='.') || (*p1==' ')))
     p1++;
-  p2 = buf;
+  sbuf.clear();
   stop = 0;
   // Reading feature description
   while (!stop) {
     // If EOL reached --> continue at next line
-    if (!*p1) {
-      if (!fchars->next_line(cline)) {
+    if (p1 == eol) {
+      if (!fchars->next_line(p1, eol)) {
         if (!fchars->eof())
           cerr << "Error reading " << fchars->get_name() << endl;
         return 0;
       }
-      p1 = cline;
-      *p2++ = ' ';  // insert blank
+      sbuf += ' ';  // insert blank
     }
     // Character description ends with '/' followed by blank or EOL
-    if ((*p1=='/') && ((!*(p1+1)) || (*(p1+1)==' '))) {   // end of description
-      *p2 = '\x00';
+    p2 = scan_bytes(p1, eol, '/');
+    sbuf.append(p1, p2 - p1);
+    p1 = p2;
+    if (p1 == eol)
+      continue;
+    if ((p1+1 == eol) || (*(p1+1)==' '))   // end of description
       stop = 1;
-    }
-    else {  // Continue
-      *p2 = *p1;
-      p1++; p2++;
-    }
+    else  // Continue
+      sbuf += *p1++;
   }
   //----- Store character feature -----
-  cd.feature = buf;
+  cd.feature = sbuf;
   cd.char_type = CT_TE;  // Default = text character. Will be overridden if
                          // numeric or multistate character (cf read_state())
-  //log(2, buf, n);
+  //log(2, sbuf.c_str(), n);
   //----- Moves pointer at end of line or at the begin of next sentence -----
   p1++;
-  while ((*p1==' ')||(*p1=='\t'))
+  while ((p1 < eol) && ((*p1==' ')||(*p1=='\t')))
     p1++;
   return 1;
 }
 
 //----- Reads a character state -----------------------------------------------
-int tDeltaCharList::read_state(char *cline, char * & p1, int & nbstates)
+int tDeltaCharList::read_state(const char * & p1, const char * & eol, int & nbstates)
 {
-  char buf[BUFSIZE];
-  char *p2;
+  const char *p2;
   int n, stop, unit;
 
   //----- Extract and verify the state number ------
   n = unit = 0;
   if (*p1>='0' && *p1<='9') {  // if there is a state number
-    n = atoi(p1);
+    n = span_atoi(p1, eol);
     if (n != nbstates+1) {
       cerr << "Parse error line " << fchars->get_lines_nb() << " : state sequence break" << endl;
       return 0;
@@ -371,51 +1208,297 @@ int tDeltaCharList::read_state(char *cline, char * & p1, int & nbstates)
     unit = 1;   // "state" without number is a unit (numeric characters)
   //----- Extract state description -----
   // Skip at begin of state description
-  while ((*p1>='0' && *p1<='9') || (*p1=='.') || (*p1==' '))
+  while ((p1 < eol) && ((*p1>='0' && *p1<='9') || (*p1=='.') || (*p1==' ')))
     p1++;
-  p2 = buf;
+  sbuf.clear();
   stop = 0;
   // Reading state description
   while (!stop) {
     // If EOL reached --> continue at next line
-    if (!*p1) {
-      if (!fchars->next_line(cline)) {
+    if (p1 == eol) {
+      if (!fchars->next_line(p1, eol)) {
         if (!fchars->eof())
           cerr << "Error reading " << fchars->get_name() << endl;
         return 0;
       }
-      p1 = cline;
-      *p2++ = ' ';  // insert blank
+      sbuf += ' ';  // insert blank
     }
     // state description ends with '/' followed by blank or EOL
-    if ((*p1=='/') && ((!*(p1+1)) || (*(p1+1)==' '))) {   // end of description
-      *p2 = '\x00';
+    p2 = scan_bytes(p1, eol, '/');
+    sbuf.append(p1, p2 - p1);
+    p1 = p2;
+    if (p1 == eol)
+      continue;
+    if ((p1+1 == eol) || (*(p1+1)==' '))   // end of description
       stop = 1;
-    }
-    else {  // Continue
-      *p2 = *p1;
-      p1++; p2++;
-    }
+    else  // Continue
+      sbuf += *p1++;
   }
   //----- Store unit or state description -----
   //--- Unit (numeric character)
   if (unit) {
-    cd.unit = buf;
+    cd.unit = sbuf;
     cd.char_type = CT_IN;   // numeric character
   }
   else {
   //--- State description (multistate character)
-    cd.states.push_back(buf);
+    if (cd.states.empty() && (nbchars <= decl_states.size()))
+      cd.states.reserve(decl_states[nbchars-1]);
+    cd.states.push_back(sbuf);
     cd.char_type = CT_UM;  // multistate character
   }
   //----- Moves pointer at end of line or at begin next sentence -----
   p1++;
-  while ((*p1==' ')||(*p1=='\t'))
+  while ((p1 < eol) && ((*p1==' ')||(*p1=='\t')))
     p1++;
   return 1;
 }
 
 
+//===== tItemSet ==============================================================
+
+//----- Sets the number of items ----------------------------------------------
+void tItemSet::resize(int n, int full)
+{
+  nb = n;
+  bits.assign((n + 63) >> 6, 0);
+  if (full)
+    fill();
+}
+
+//----- Removes all items -----------------------------------------------------
+void tItemSet::clear(void)
+{
+  bits.assign(bits.size(), 0);
+}
+
+//----- Adds all items --------------------------------------------------------
+void tItemSet::fill(void)
+{
+  bits.assign(bits.size(), ~0ULL);
+  if (nb & 63)  // unused bits of the last word are kept to 0
+    bits.back() = (1ULL << (nb & 63)) - 1;
+}
+
+//----- Number of items in the set --------------------------------------------
+int tItemSet::count(void) const
+{
+  int i, n;
+
+  n = 0;
+  for (i=0; i<bits.size(); i++)
+    n += __builtin_popcountll(bits[i]);
+  return n;
+}
+
+//----- Test if the set is empty ----------------------------------------------
+int tItemSet::empty(void) const
+{
+  int i;
+
+  for (i=0; i<bits.size(); i++)
+    if (bits[i])
+      return 0;
+  return 1;
+}
+
+//----- Next item in the set (0 if no more items) -----------------------------
+int tItemSet::next(int itemnum) const
+{
+  unsigned long long w;
+  int i;
+
+  if (itemnum >= nb)
+    return 0;
+  i = itemnum >> 6;  // word of the next item (itemnum+1 --> bit itemnum)
+  w = bits[i] & (~0ULL << (itemnum & 63));
+  while (!w) {
+    if (++i >= bits.size())
+      return 0;
+    w = bits[i];
+  }
+  return (i << 6) + __builtin_ctzll(w) + 1;
+}
+
+//----- Intersection, union, difference ---------------------------------------
+tItemSet & tItemSet::operator &= (const tItemSet & s)
+{
+  int i;
+
+  for (i=0; (i<bits.size()) && (i<s.bits.size()); i++)
+    bits[i] &= s.bits[i];
+  return *this;
+}
+
+tItemSet & tItemSet::operator |= (const tItemSet & s)
+{
+  int i;
+
+  for (i=0; (i<bits.size()) && (i<s.bits.size()); i++)
+    bits[i] |= s.bits[i];
+  return *this;
+}
+
+tItemSet & tItemSet::operator -= (const tItemSet & s)
+{
+  int i;
+
+  for (i=0; (i<bits.size()) && (i<s.bits.size()); i++)
+    bits[i] &= ~s.bits[i];
+  return *this;
+}
+
+
+//===== tIntervalIndex ========================================================
+
+//----- Adds an interval ------------------------------------------------------
+void tIntervalIndex::add(double lo, double hi, int itemnum)
+{
+  tInterval iv;
+
+  iv.lo = lo;
+  iv.hi = iv.max = hi;
+  iv.itemnum = itemnum;
+  intervals.push_back(iv);
+  root_level = -1;
+}
+
+//----- Builds the implicit tree ----------------------------------------------
+//        Node i is at level k if its k lowest bits are 1 (leaves are at even
+//        positions); its children are i-2^(k-1) and i+2^(k-1).
+void tIntervalIndex::build(void)
+{
+  long i, n, x, last_i;
+  double last, e;
+  int k;
+
+  root_level = -1;
+  n = intervals.size();
+  if (!n)
+    return;
+  sort(intervals.begin(), intervals.end());
+  for (i=0; i<n; i+=2) {
+    last_i = i;
+    last = intervals[i].max = intervals[i].hi;
+  }
+  for (k=1; (1L << k) <= n; k++) {
+    x = 1L << (k-1);
+    for (i=(x << 1)-1; i<n; i+=(x << 2)) {
+      e = intervals[i].hi;
+      if (intervals[i-x].max > e)
+        e = intervals[i-x].max;
+      if ((i+x < n ? intervals[i+x].max : last) > e)
+        e = (i+x < n ? intervals[i+x].max : last);
+      intervals[i].max = e;
+    }
+    last_i = ((last_i >> k) & 1) ? last_i - x : last_i + x;
+    if ((last_i < n) && (intervals[last_i].max > last))
+      last = intervals[last_i].max;
+  }
+  root_level = k - 1;
+}
+
+//----- Searches the intervals containing a value -----------------------------
+void tIntervalIndex::search(double value, tItemSet & result) const
+{
+  struct { long x; int k, w; } stack[64], z;
+  long i, i0, i1, n, y;
+  int t;
+
+  if (root_level < 0)
+    return;  // empty or not built index
+  n = intervals.size();
+  t = 0;
+  stack[t].x = (1L << root_level) - 1;  // root
+  stack[t].k = root_level;
+  stack[t++].w = 0;
+  while (t) {
+    z = stack[--t];
+    if (z.k <= 3) {
+      //--- Small subtree : linear scan
+      i0 = z.x >> z.k << z.k;
+      i1 = i0 + (1L << (z.k+1)) - 1;
+      if (i1 > n)
+        i1 = n;
+      for (i=i0; (i < i1) && (intervals[i].lo <= value); i++)
+        if (value <= intervals[i].hi)
+          result.add(intervals[i].itemnum);
+    }
+    else
+      if (!z.w) {
+        //--- Left child not yet processed
+        y = z.x - (1L << (z.k-1));
+        stack[t].x = z.x;
+        stack[t].k = z.k;
+        stack[t++].w = 1;
+        if ((y >= n) || (intervals[y].max >= value)) {
+          stack[t].x = y;
+          stack[t].k = z.k - 1;
+          stack[t++].w = 0;
+        }
+      }
+      else
+        if ((z.x < n) && (intervals[z.x].lo <= value)) {
+          //--- Node itself, then right child
+          if (value <= intervals[z.x].hi)
+            result.add(intervals[z.x].itemnum);
+          stack[t].x = z.x + (1L << (z.k-1));
+          stack[t].k = z.k - 1;
+          stack[t++].w = 0;
+        }
+  }
+}
+
+
+//===== tItemMatrix ===========================================================
+
+//----- Comparison of the cell of an item with values --------------------------
+int tItemMatrix::cell_matches(const tColumn & col, int itemnum, const double *values,
+                              int nbval, int strict, int with_extrval) const
+{
+  unsigned k;
+
+  if (col.missing.contains(itemnum))
+    return strict ? 0 : 1;  // UNKNOWN value (see tItemDescr::matches)
+  for (k=col.cells[itemnum-1]; k<col.cells[itemnum]; k++)
+    if (tAltDescr::compare_values(col.values.data() + col.alts[k], col.alts[k+1] - col.alts[k],
+                                  col.val_rel[k], col.extr_val[k], values, nbval,
+                                  strict, with_extrval))
+      return 1;
+  return 0;
+}
+
+//----- Test if an item is matching with values --------------------------------
+int tItemMatrix::matches(int itemnum, int charnum, const double *values, int nbval,
+                         int strict, int with_extrval) const
+{
+  if ((itemnum < 1) || (itemnum > nbitems)) {
+    cerr << "Invalid item number" << endl;
+    return 0;
+  }
+  if ((charnum < 1) || (charnum > columns.size()))
+    return strict ? 0 : 1;  // character not found : UNKNOWN value
+  return cell_matches(columns[charnum-1], itemnum, values, nbval, strict, with_extrval);
+}
+
+//----- Removes from a set the items not matching with values ------------------
+void tItemMatrix::select(int charnum, const double *values, int nbval, tItemSet & result,
+                         int strict, int with_extrval) const
+{
+  int i;
+
+  if ((charnum < 1) || (charnum > columns.size())) {
+    if (strict)
+      result.clear();  // character not found : UNKNOWN value
+    return;
+  }
+  const tColumn & col = columns[charnum-1];
+  for (i=result.first(); i; i=result.next(i))
+    if (!cell_matches(col, i, values, nbval, strict, with_extrval))
+      result.remove(i);
+}
+
+
 //===== tDeltaItemList ========================================================
 
 // Constructors
@@ -424,6 +1507,10 @@ tDeltaItemList::tDeltaItemList(void)
 {
   fitems = NULL;
   nbitems = 0;
+  decl_items = 0;
+  threads = 1;
+  use_arena = 0;
+  lazy = 0;
   parsed = 0;
 }
 
@@ -431,74 +1518,166 @@ tDeltaItemList::tDeltaItemList(const char *fname, int parse)
 {
   fitems = new tDeltaFile(fname);
   nbitems = 0;
+  decl_items = 0;
+  threads = 1;
+  use_arena = 0;
+  lazy = 0;
   parsed = 0;
   if (parse)
     parse_items();
 }
 
+// Destructor
+tDeltaItemList::~tDeltaItemList(void)
+{
+  item_list.clear();  // items are destroyed before their arenas
+  free_arenas();
+  delete fitems;
+}
+
 
 // Public member functions
 
 //----- Parse the item file ---------------------------------------------------
 int tDeltaItemList::parse_items(void)
 {
-  char cline[LMAXLINE];
-  char *p1;
-  int ok;
+  unsigned long long key;
+  int ok, n;
 
   //--- Test if items file exist ---
   if (!fitems)
     return 0;
   //--- Reset data from previous parsing
-  if (parsed) {
-    item_list.erase(item_list.begin(), item_list.end());
-    directives.erase(directives.begin(), directives.end());
+  item_list.clear();
+  directives.clear();
+  dir_table.clear();
+  free_arenas();  // after the items allocated in them
+  parsed = 0;
+  nbitems = 0;
+  //--- Parsed form in the cache ---
+  key = 0;
+  if (cache_dir.size() && (key = tParseCache::file_key(fitems->get_name(), "items"))) {
+    tParseCache cache;
+    if (cache.load(cache_dir, key) && load_cache(cache)) {
+      dir_table.add(directives);
+      nbitems = item_list.size();
+      parsed = 1;
+      return 1;
+    }
   }
   //--- Open the file ---
   if (!fitems->open(AM_READ)) {
     cerr << "Unable to open " << fitems->get_name() << endl;
     return 0;
   }
+  //--- Parsing ---
+  n = threads;
+  if (n < 1)
+    n = thread::hardware_concurrency();
+  if ((n > 1) && fitems->is_mapped())
+    ok = parse_parallel(n);
+  else {
+    tParseCtx ctx(fitems, new_arena(fitems->is_mapped() ?
+                                    fitems->get_data_end() - fitems->get_data() : 0));
+    item_list.reserve(plausible_count(decl_items, fitems, 4));
+    ok = parse_block(ctx, item_list);
+    directives.swap(ctx.directives);
+  }
+  fitems->close();
+  if (!ok)
+    return 0;
+  dir_table.add(directives);
+  if (key) {
+    tParseCache cache;
+    save_cache(cache);
+    cache.store(cache_dir, key);
+  }
+  //--- End parsing ---
+  nbitems = item_list.size();
+  parsed = 1;
+  return 1;
+}
+
+//----- Storing the parsed items in the parse cache ---------------------------
+void tDeltaItemList::save_cache(tParseCache & cache)
+{
+  int i, j;
+
+  cache.put_int(directives.size());
+  for (i=0; i<directives.size(); i++)
+    cache.put_string(directives[i]);
+  cache.put_int(item_list.size());
+  for (i=0; i<item_list.size(); i++) {
+    cache.put_string(item_list[i].name);
+    cache.put_string(item_list[i].comment);
+    cache.put_int(item_list[i].attributes.size());
+    for (j=0; j<item_list[i].attributes.size(); j++)
+      item_list[i].attributes[j].save_cache(cache);
+  }
+}
+
+//----- Loading the items from the parse cache --------------------------------
+//        return value : 1=ok 0=invalid entry (nothing loaded)
+int tDeltaItemList::load_cache(tParseCache & cache)
+{
+  int i, j, n, ok;
+
+  n = cache.get_count();
+  directives.resize(n > 0 ? n : 0);
+  for (i=0; i<directives.size(); i++)
+    cache.get_string(directives[i]);
+  n = cache.get_count();
+  item_list.resize(n > 0 ? n : 0, tItemDescr(tItemDescr::allocator_type(new_arena(n * 256L))));
   ok = 1;
-  p1 = NULL;
-  //--- Reading loop ---
-  while (ok) {
-    if ((p1==NULL) || (!*p1)) {
-      //--- Extract next line from item file ---
-      ok = fitems->next_line(cline);
-      if (!ok) {
-        //--- End of file or error ---
-        if (!fitems->eof()) {
-          cerr << "Error reading " << fitems->get_name() << endl;
-          return 0;
-        }
-        if (nbitems)   // at least one item is already read
-          item_list.push_back(id);  // Store the last item read
-        //--- End parsing ---
-	parsed = 1;
-        return 1;
-      }
-      p1 = cline;
-    }
-    //--- Processing the line ---
-    if (*p1 == '*')
-      //--- Reading a directive ---
-      ok = read_directive(cline, p1);
-    else
-      if (*p1 == '#') {
-        //--- Reading an item ---
-        // Before reading the next item, we store the current one
-        if (nbitems) {  // at least one item is already read
-          item_list.push_back(id);
-          // reinit attribute list
-          id.attributes.erase(id.attributes.begin(), id.attributes.end());  
-        }
-        ok = read_item(cline, p1);
-      }
-      else
-        cerr << "Error parsing " << fitems->get_name() << endl;
+  for (i=0; (i<item_list.size()) && ok; i++) {
+    tItemDescr & id = item_list[i];
+    cache.get_string(id.name);
+    cache.get_string(id.comment);
+    n = cache.get_count();
+    id.attributes.resize(n > 0 ? n : 0);
+    for (j=0; (j<id.attributes.size()) && ok; j++)
+      ok = id.attributes[j].load_cache(cache);
+    id.build_index();
   }
-  return 0;
+  if (!ok || !cache.is_complete()) {
+    item_list.clear();
+    directives.clear();
+    return 0;
+  }
+  return 1;
+}
+
+//----- Memory resource for the items parsed from a file (block) --------------
+//        size = size of the text to parse (for the first arena buffer)
+//        return value : new arena, or default resource if arenas are not used
+#define ARENA_FIRST_MAX (64L << 20)   // maximum size of the first arena buffer
+
+pmr::memory_resource *tDeltaItemList::new_arena(long size)
+{
+  pmr::monotonic_buffer_resource *arena;
+
+  if (!use_arena)
+    return pmr::get_default_resource();
+  // Parsed items take about 4 times the size of their text (about the size
+  // of the text with a lazy parsing). The first buffer is capped : the
+  // next ones grow geometrically.
+  if (!lazy)
+    size *= 4;
+  if (size > ARENA_FIRST_MAX)
+    size = ARENA_FIRST_MAX;
+  arena = new pmr::monotonic_buffer_resource(size > 0 ? size : 1 << 20);
+  arenas.push_back(arena);
+  return arena;
+}
+
+//----- Releases the arenas (no item must remain in them) ---------------------
+void tDeltaItemList::free_arenas(void)
+{
+  int i;
+
+  for (i=0; i<arenas.size(); i++)
+    delete arenas[i];
+  arenas.clear();
 }
 
 //----- Set or change the item list filename ----------------------------------
@@ -514,7 +1693,7 @@ void tDeltaItemList::set_filename(const char *fname, int parse)
 }
 
 //----- Retrieves the item list filename --------------------------------------
-const char *tDeltaItemList::get_filename(void)
+const char *tDeltaItemList::get_filename(void) const
 {
   if (fitems)
     return fitems->get_name();
@@ -523,35 +1702,22 @@ const char *tDeltaItemList::get_filename(void)
 }
 
 //----- Retrieves the number of items -----------------------------------------
-int tDeltaItemList::get_items_nb(void)
+int tDeltaItemList::get_items_nb(void) const
 {
   return item_list.size();
 }
 
 //----- Retrieves an item name ------------------------------------------------
-string tDeltaItemList::get_item_name(int itemnum, int comment)
+string tDeltaItemList::get_item_name(int itemnum, int comment) const
 {
-  char *buf;
-
   if ((itemnum < 1) || (itemnum > item_list.size()))
     return "";
   else
-    // Returns item name with comments
-    if (comment)
-      return item_list[itemnum-1].name;
-    // Returns item name after removing comments
-    else {
-      buf = new char[item_list[itemnum-1].name.size()+1];
-      remove_comments(item_list[itemnum-1].name.c_str(), buf);
-      // note : string.c_str() retrieves the string as char*
-      str = buf;   // char* --> string
-      delete buf;
-      return str;
-    }
+    return tItemView(itemnum, item_list[itemnum-1]).get_item_name(comment);
 }
 
 //----- Retrieves the number of attributes ------------------------------------
-int tDeltaItemList::get_attributes_nb(int itemnum)
+int tDeltaItemList::get_attributes_nb(int itemnum) const
 {
   if ((itemnum < 1) || (itemnum > item_list.size()))
     return 0;
@@ -560,86 +1726,526 @@ int tDeltaItemList::get_attributes_nb(int itemnum)
 }
 
 //----- Retrieves an item attribute -------------------------------------------
-string tDeltaItemList::get_attribute(int itemnum, int attrnum)
+string tDeltaItemList::get_attribute(int itemnum, int attrnum) const
+{
+  if ((itemnum < 1) || (itemnum > item_list.size())) {
+    cerr << "Invalid item number" << endl;
+    return "";
+  }
+  return tItemView(itemnum, item_list[itemnum-1]).get_attribute(attrnum);
+}
+
+
+//===== tItemView =============================================================
+
+//----- Retrieves the item name -----------------------------------------------
+string tItemView::get_item_name(int comment) const
+{
+  string str;
+
+  // Returns item name with comments
+  if (comment)
+    return string(item.name);
+  // Returns item name after removing comments
+  str.resize(item.name.size()+1);
+  remove_comments(item.name.c_str(), &str[0]);
+  str.resize(strlen(str.c_str()));
+  return str;
+}
+
+//----- Retrieves an item attribute -------------------------------------------
+string tItemView::get_attribute(int attrnum) const
 {
   string str;
-  char ch[8];
+  char ch[16];
+
+  if ((attrnum < 1) || (attrnum > item.attributes.size())) {
+    cerr << "Invalid attribute number" << endl;
+    return "";
+  }
+  sprintf(ch, "%d", item.attributes[attrnum-1].get_charnum());
+  str  = ch + item.attributes[attrnum-1].get_charcomment()
+         + "," + item.attributes[attrnum-1].get_alternatives();
+  return str;
+}
+
+
+//----- Searches the first item matching with a given character value(s) ------
+int tDeltaItemList::first_matching(int charnum, double *values, int nbval,
+                                   int strict, int with_extrval)
+{
+  return first_matching(last_matching, charnum, values, nbval, strict, with_extrval);
+}
+
+
+//----- Searches the next item matching with a given character value(s) -------
+int tDeltaItemList::next_matching(int charnum, double *values, int nbval,
+                                  int strict, int with_extrval)
+{
+  return next_matching(last_matching, charnum, values, nbval, strict, with_extrval);
+}
+
+//----- Searches the first matching item (caller's cursor) --------------------
+int tDeltaItemList::first_matching(tMatchCursor & cursor, int charnum,
+                                   const double *values, int nbval,
+                                   int strict, int with_extrval) const
+{
+  cursor.itemnum = 0;
+  return next_matching(cursor, charnum, values, nbval, strict, with_extrval);
+}
+
+//----- Searches the next matching item (caller's cursor) ---------------------
+//        The cursor is left unchanged if no more item is found
+int tDeltaItemList::next_matching(tMatchCursor & cursor, int charnum,
+                                  const double *values, int nbval,
+                                  int strict, int with_extrval) const
+{
+  int i, n;
+
+  n = item_list.size();
+  for (i=cursor.itemnum; i<n; i++)  // search begins after last matching item
+    if (item_list[i].matches(charnum, values, nbval, strict, with_extrval)) {
+      cursor.itemnum = i+1;
+      return cursor.itemnum;
+    }
+  return 0;
+}
 
+//----- Test if a given item is matching with values --------------------------
+int tDeltaItemList::matches(int itemnum, int charnum, const double *values, int nbval,
+                            int strict, int with_extrval) const
+{
   if ((itemnum < 1) || (itemnum > item_list.size())) {
     cerr << "Invalid item number" << endl;
-    return "";
+    return 0;
+  }
+  return item_list[itemnum-1].matches(charnum, values, nbval, strict, with_extrval);
+}
+
+//----- Search a character in attributes list and make value(s) comparison ----
+int tDeltaItemList::tItemDescr::matches(int charnum, const double *values, int nbval,
+                                        int strict, int with_extrval) const
+{
+  int i;
+
+  i = find_attribute(charnum);
+  if (i >= 0)
+    return attributes[i].compare(values, nbval, strict, with_extrval);
+  //--- Character not found
+  // Note : If the character is not found, his value is considered as UNKNOWN
+  if (strict)
+    return 0;  //UNKNOWN value never matching if "strict" compare (default)
+  else
+    return 1;
+}
+
+//----- Builds the character index of an item --------------------------------
+void tDeltaItemList::tItemDescr::build_index(void)
+{
+  int i, j, n, c;
+
+  char_index.clear();
+  n = attributes.size();
+  for (i=1; i<n; i++)
+    if (attributes[i].get_charnum() < attributes[i-1].get_charnum())
+      break;
+  if (i >= n)
+    return;  // attributes already sorted : no index needed
+  //--- Insertion sort (attributes are generally almost sorted)
+  char_index.resize(n);
+  for (i=0; i<n; i++) {
+    c = attributes[i].get_charnum();
+    for (j=i; (j > 0) && (attributes[char_index[j-1]].get_charnum() > c); j--)
+      char_index[j] = char_index[j-1];
+    char_index[j] = i;
+  }
+}
+
+//----- Position of a character in attributes list (binary search) -----------
+//        If a character appears several times, the first one is retrieved
+int tDeltaItemList::tItemDescr::find_attribute(int charnum) const
+{
+  int lo, hi, mid, pos;
+
+  lo = 0;
+  hi = attributes.size();
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    pos = char_index.empty() ? mid : char_index[mid];
+    if (attributes[pos].get_charnum() < charnum)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo >= attributes.size())
+    return -1;
+  pos = char_index.empty() ? lo : char_index[lo];
+  return (attributes[pos].get_charnum() == charnum) ? pos : -1;
+}
+
+//----- Builds the inverted index of multistate characters --------------------
+//        For each item and each state, the result of matches() with this state
+//        as unique value is stored in a bitset. UNKNOWN values (and missing
+//        characters) are stored apart since they match only if not "strict".
+int tDeltaItemList::build_state_index(tDeltaCharList *chars)
+{
+  double x;
+  int c, s, i, j, n, nc, ns, ct, nb, diff;
+
+  n = item_list.size();
+  nc = chars->get_chars_nb();
+  state_index.clear();
+  state_index.resize(nc);
+  nb = 0;
+  for (c=1; c<=nc; c++) {
+    ct = chars->get_char_type(c);
+    ns = chars->get_states_nb(c);
+    if (((ct != CT_UM) && (ct != CT_OM)) || (ns < 1))
+      continue;
+    tStateIndex & si = state_index[c-1];
+    vector<tItemSet> ne(ns, tItemSet(n));
+    si.states.assign(ns, tItemSet(n));
+    si.unknown.resize(n);
+    for (i=0; i<n; i++) {
+      j = item_list[i].find_attribute(c);
+      if (j < 0) {   // missing character --> UNKNOWN
+        si.unknown.add(i+1);
+        continue;
+      }
+      tAttrDescr & ad = item_list[i].attributes[j];
+      // UNKNOWN alternative : matching with any value (0 here) only if not strict
+      x = 0;
+      if (ad.compare(&x, 1, 0, 1) && !ad.compare(&x, 1, 1, 1))
+        si.unknown.add(i+1);
+      for (s=1; s<=ns; s++) {
+        x = s;
+        if (ad.compare(&x, 1, 1, 1))
+          si.states[s-1].add(i+1);
+        if (ad.compare(&x, 1, 1, 0))
+          ne[s-1].add(i+1);
+      }
+    }
+    // Sets without extreme values are kept only if they are different
+    diff = 0;
+    for (s=0; (s<ns) && !diff; s++)
+      diff = !(ne[s] == si.states[s]);
+    if (diff)
+      si.states_ne.swap(ne);
+    nb++;
+  }
+  return nb;
+}
+
+//----- Builds the interval index of numeric characters -----------------------
+//        Each alternative gives an interval : [v, v] for a single value (or
+//        several equal values with '&'), [first, last] for a range. VARIABLE
+//        and UNKNOWN values (and missing characters) are stored apart.
+int tDeltaItemList::build_range_index(tDeltaCharList *chars)
+{
+  double x;
+  int c, i, j, k, m, n, nc, ct, nb, first, last;
+
+  n = item_list.size();
+  nc = chars->get_chars_nb();
+  range_index.clear();
+  range_index.resize(nc);
+  nb = 0;
+  for (c=1; c<=nc; c++) {
+    ct = chars->get_char_type(c);
+    if ((ct != CT_IN) && (ct != CT_RN))
+      continue;
+    tRangeIndex & ri = range_index[c-1];
+    ri.indexed = 1;
+    ri.variable.resize(n);
+    ri.unknown.resize(n);
+    for (i=0; i<n; i++) {
+      j = item_list[i].find_attribute(c);
+      if (j < 0) {   // missing character --> UNKNOWN
+        ri.unknown.add(i+1);
+        continue;
+      }
+      tAttrDescr & ad = item_list[i].attributes[j];
+      for (k=1; k<=ad.get_alt_nb(); k++) {
+        tAltDescr & alt = ad.get_alt(k);
+        m = alt.get_values_nb();
+        if (!m)
+          continue;
+        x = alt.get_value(1);
+        switch (alt.get_val_rel()) {
+          case 0 :     // unique value
+            if (x == VARIABLE)
+              ri.variable.add(i+1);
+            else
+              if (x == UNKNOWN)
+                ri.unknown.add(i+1);
+              else
+                if (x != NOTAPPLI) {
+                  ri.ranges.add(x, x, i+1);
+                  ri.ranges_ne.add(x, x, i+1);
+                }
+            break;
+          case '&' :   // matching one value only if all values are equal
+            for (j=2; (j<=m) && (alt.get_value(j) == x); j++) ;
+            if (j > m) {
+              ri.ranges.add(x, x, i+1);
+              ri.ranges_ne.add(x, x, i+1);
+            }
+            break;
+          case '-' :   // range
+            ri.ranges.add(x, alt.get_value(m), i+1);
+            first = (alt.get_extr_val() & EXTRVAL_LOW) ? 2 : 1;
+            last = (alt.get_extr_val() & EXTRVAL_HIGH) ? m-1 : m;
+            if (first <= last)
+              ri.ranges_ne.add(alt.get_value(first), alt.get_value(last), i+1);
+            break;
+        }
+      }
+    }
+    ri.ranges.build();
+    ri.ranges_ne.build();
+    nb++;
+  }
+  return nb;
+}
+
+//----- Builds all identification indexes ------------------------------------
+int tDeltaItemList::build_indexes(tDeltaCharList *chars)
+{
+  return build_state_index(chars) + build_range_index(chars);
+}
+
+//----- Builds the item x character matrix ------------------------------------
+//        Items are read once, each attribute being appended to the column of
+//        its character (if a character appears several times in an item, the
+//        first attribute is kept, as in tItemDescr::find_attribute)
+int tDeltaItemList::build_matrix(tDeltaCharList *chars)
+{
+  vector<int> last_item;  // last item appended to each column
+  int c, i, j, k, l, n, nc, m;
+
+  n = item_list.size();
+  nc = chars->get_chars_nb();
+  matrix.clear();
+  matrix.nbitems = n;
+  matrix.columns.resize(nc);
+  for (c=0; c<nc; c++) {
+    matrix.columns[c].cells.assign(1, 0);
+    matrix.columns[c].cells.reserve(n+1);
+    matrix.columns[c].alts.assign(1, 0);
+    matrix.columns[c].missing.resize(n);
+  }
+  last_item.assign(nc, 0);
+  for (i=1; i<=n; i++) {
+    const pmr::vector<tAttrDescr> & attr = item_list[i-1].attributes;
+    for (j=0; j<attr.size(); j++) {
+      c = attr[j].get_charnum();
+      if ((c < 1) || (c > nc) || (last_item[c-1] == i))
+        continue;
+      last_item[c-1] = i;
+      tItemMatrix::tColumn & col = matrix.columns[c-1];
+      for (k=1; k<=attr[j].get_alt_nb(); k++) {
+        const tAltDescr & alt = attr[j].get_alt(k);
+        m = alt.get_values_nb();
+        for (l=1; l<=m; l++)
+          col.values.push_back(alt.get_value(l));
+        col.alts.push_back(col.values.size());
+        col.val_rel.push_back(alt.get_val_rel());
+        col.extr_val.push_back(alt.get_extr_val());
+      }
+    }
+    for (c=0; c<nc; c++) {
+      tItemMatrix::tColumn & col = matrix.columns[c];
+      col.cells.push_back(col.val_rel.size());
+      if (last_item[c] != i)
+        col.missing.add(i);
+    }
+  }
+  for (c=0; c<nc; c++) {  // arrays are not grown any more
+    matrix.columns[c].alts.shrink_to_fit();
+    matrix.columns[c].val_rel.shrink_to_fit();
+    matrix.columns[c].extr_val.shrink_to_fit();
+    matrix.columns[c].values.shrink_to_fit();
+  }
+  return nc;
+}
+
+//----- Test if a character is indexed ----------------------------------------
+int tDeltaItemList::has_index(int charnum) const
+{
+  if (charnum < 1)
+    return 0;
+  if ((charnum <= state_index.size()) && !state_index[charnum-1].states.empty())
+    return 1;
+  if ((charnum <= range_index.size()) && range_index[charnum-1].indexed)
+    return 1;
+  return 0;
+}
+
+//----- Items matching a value of an indexed character ------------------------
+int tDeltaItemList::matching_items(int charnum, double value, tItemSet & result,
+                                   int strict, int with_extrval) const
+{
+  int state;
+
+  if (charnum < 1)
+    return 0;
+  //--- Multistate character
+  if ((charnum <= state_index.size()) && !state_index[charnum-1].states.empty()) {
+    const tStateIndex & si = state_index[charnum-1];
+    state = (int) value;
+    if ((state != value) || (state < 1) || (state > si.states.size()))
+      return 0;
+    if (!with_extrval && si.states_ne.size())
+      result = si.states_ne[state-1];
+    else
+      result = si.states[state-1];
+    if (!strict)
+      result |= si.unknown;
+    return 1;
   }
-  if ((attrnum < 1) || (attrnum > item_list[itemnum-1].attributes.size())) {
-    cerr << "Invalid attribute number" << endl;
-    return "";
+  //--- Numeric character
+  if ((charnum <= range_index.size()) && range_index[charnum-1].indexed) {
+    const tRangeIndex & ri = range_index[charnum-1];
+    result.resize(item_list.size());
+    if (with_extrval)
+      ri.ranges.search(value, result);
+    else
+      ri.ranges_ne.search(value, result);
+    result |= ri.variable;
+    if (!strict)
+      result |= ri.unknown;
+    return 1;
   }
-  sprintf(ch, "%d", item_list[itemnum-1].attributes[attrnum-1].get_charnum());
-  str  = ch + item_list[itemnum-1].attributes[attrnum-1].get_charcomment()
-         + "," + item_list[itemnum-1].attributes[attrnum-1].get_alternatives();
-  return str;
+  return 0;
 }
 
-
-//----- Searches the first item matching with a given character value(s) ------
-int tDeltaItemList::first_matching(int charnum, double *values, int nbval,
-                                   int strict, int with_extrval)
+//----- Items matching a specimen description ---------------------------------
+int tDeltaItemList::identify(const tSpecimen & specimen, tItemSet & result,
+                             int strict, int with_extrval) const
 {
-  int i, n;
+  return identify_items(specimen, NULL, result, strict, with_extrval, NULL);
+}
 
-  last_matching = 0;
-  n = item_list.size();
-  for (i=0; i<n; i++)
-    if (item_list[i].matches(charnum, values, nbval, strict, with_extrval))
-      last_matching = i+1;
-  return last_matching;
+//----- Identification of several specimens -------------------------------------
+int tDeltaItemList::identify(const vector<tSpecimen> & specimens,
+                             vector<tItemSet> & results, int strict,
+                             int with_extrval) const
+{
+  map<tCriterion, tItemSet> cache;  // item sets of the indexed criteria
+  int i, nb;
+
+  results.resize(specimens.size());
+  nb = 0;
+  for (i=0; i<specimens.size(); i++)
+    if (identify_items(specimens[i], NULL, results[i], strict, with_extrval, &cache) == 1)
+      nb++;
+  return nb;
 }
 
+//----- Identification without the inapplicable characters ---------------------
+int tDeltaItemList::identify(const tSpecimen & specimen, const tItemSet & inapplicable,
+                             tItemSet & result, int strict, int with_extrval) const
+{
+  return identify_items(specimen, &inapplicable, result, strict, with_extrval, NULL);
+}
 
-//----- Searches the next item matching with a given character value(s) -------
-int tDeltaItemList::next_matching(int charnum, double *values, int nbval,
-                                  int strict, int with_extrval)
+int tDeltaItemList::identify(const vector<tSpecimen> & specimens,
+                             const vector<tItemSet> & inapplicable,
+                             vector<tItemSet> & results, int strict,
+                             int with_extrval) const
 {
-  int i, n, res=0;
+  map<tCriterion, tItemSet> cache;  // item sets of the indexed criteria
+  int i, nb;
+
+  results.resize(specimens.size());
+  nb = 0;
+  for (i=0; i<specimens.size(); i++)
+    if (identify_items(specimens[i], (i < inapplicable.size()) ? &inapplicable[i] : NULL,
+                       results[i], strict, with_extrval, &cache) == 1)
+      nb++;
+  return nb;
+}
 
-  i = last_matching ? last_matching : 0;  // search begins after last matching item
-  n = item_list.size();
-  for ( ; i<n; i++)
-    if (item_list[i].matches(charnum, values, nbval, strict, with_extrval))
-      res = i+1;
-  if (res) {
-    last_matching = res;
-    return last_matching;
+//----- Items matching a specimen (item sets of indexed criteria may be cached)
+int tDeltaItemList::identify_items(const tSpecimen & specimen, const tItemSet * inapplicable,
+                                   tItemSet & result, int strict, int with_extrval,
+                                   map<tCriterion, tItemSet> * cache) const
+{
+  map<tCriterion, tItemSet>::iterator it;
+  vector<char> done;
+  tItemSet cs;
+  int i, j, c;
+
+  result.resize(item_list.size(), 1);
+  done.assign(specimen.size(), 0);
+  //--- Criteria on inapplicable characters are not compared
+  if (inapplicable)
+    for (i=0; i<specimen.size(); i++) {
+      c = specimen[i].charnum;
+      if ((c >= 1) && (c <= inapplicable->size()) && inapplicable->contains(c))
+        done[i] = 1;
+    }
+  //--- First pass : indexed criteria (intersection of item sets)
+  for (i=0; i<specimen.size(); i++) {
+    const tCriterion & cr = specimen[i];
+    if (done[i] || (cr.values.size() != 1))
+      continue;
+    if (cache && ((it = cache->find(cr)) != cache->end())) {
+      result &= it->second;
+      done[i] = 1;
+    }
+    else if (matching_items(cr.charnum, cr.values[0], cs, strict, with_extrval)) {
+      result &= cs;
+      done[i] = 1;
+      if (cache)
+        cache->insert(make_pair(cr, cs));
+    }
   }
-  return 0;
+  //--- Second pass : other criteria, tested only on remaining items
+  for (i=0; i<specimen.size(); i++) {
+    const tCriterion & cr = specimen[i];
+    if (done[i] || cr.values.empty())
+      continue;
+    if (matrix.is_built())
+      matrix.select(cr.charnum, &cr.values[0], cr.values.size(), result,
+                    strict, with_extrval);
+    else
+      for (j=result.first(); j; j=result.next(j))
+        if (!item_list[j-1].matches(cr.charnum, &cr.values[0], cr.values.size(),
+                                    strict, with_extrval))
+          result.remove(j);
+  }
+  return result.count();
 }
 
-//----- Test if a given item is matching with values --------------------------
-int tDeltaItemList::matches(int itemnum, int charnum, double *values, int nbval,
-                            int strict, int with_extrval)
+//----- Removes attributes of excluded characters and renumbers the others ---
+static void renumber_attributes(pmr::vector<tAttrDescr> &attr, const vector<int> &charmap)
 {
-  if ((itemnum < 1) || (itemnum > item_list.size())) {
-    cerr << "Invalid item number" << endl;
-    return 0;
+  int j, k, n, c;
+
+  n = attr.size();
+  for (j=0, k=0; j<n; j++) {
+    c = attr[j].get_charnum();
+    if ((c >= 1) && (c < charmap.size()) && charmap[c]) {
+      if (j != k)
+        attr[k] = move(attr[j]);
+      attr[k].set_charnum(charmap[c]);
+      k++;
+    }
   }
-  return item_list[itemnum-1].matches(charnum, values, nbval, strict, with_extrval);
+  attr.erase(attr.begin()+k, attr.end());
 }
 
-//----- Search a character in attributes list and make value(s) comparison ----
-int tDeltaItemList::tItemDescr::matches(int charnum, double *values, int nbval,
-                                        int strict, int with_extrval)
+void tDeltaItemList::renumber_characters(const vector<int> &charmap)
 {
-  int i, n;
+  int i;
 
-  n = attributes.size();
-  for (i=0; i<n; i++)
-    if (attributes[i].get_charnum() == charnum)
-      return attributes[i].compare(values, nbval, strict, with_extrval);
-  //--- Character not found
-  // Note : If the character is not found, his value is considered as UNKNOWN
-  if (strict)
-    return 0;  //UNKNOWN value never matching if "strict" compare (default)
-  else
-    return 1;
+  clear_indexes();  // indexes and matrix must be rebuilt (see tDelta::exclude_characters)
+  clear_matrix();
+  for (i=0; i<item_list.size(); i++) {
+    renumber_attributes(item_list[i].attributes, charmap);
+    item_list[i].build_index();
+  }
 }
 
 //----- For debuging
@@ -716,138 +2322,303 @@ void tDeltaItemList::retrieve_all(void)
 
 // Private member functions
 
+//----- Parses a file or a block of file ---------------------------------
+//        Items read are appended to list
+int tDeltaItemList::parse_block(tParseCtx & ctx, vector<tItemDescr> & list)
+{
+  const char *p1, *eol;
+  int ok;
+
+  ok = 1;
+  p1 = eol = NULL;
+  //--- Reading loop ---
+  while (ok) {
+    if (p1 == eol) {
+      //--- Extract next line from item file ---
+      ok = ctx.file->next_line(p1, eol);
+      if (!ok) {
+        //--- End of file or error ---
+        if (!ctx.file->eof()) {
+          cerr << "Error reading " << ctx.file->get_name() << endl;
+          return 0;
+        }
+        if (ctx.nbitems)  // at least one item is already read
+          store_item(ctx, list);  // Store the last item read
+        return 1;
+      }
+    }
+    //--- Processing the line ---
+    if (*p1 == '*')
+      //--- Reading a directive ---
+      ok = read_directive(ctx, p1, eol);
+    else
+      if (*p1 == '#') {
+        //--- Reading an item ---
+        // Before reading the next item, we store the current one
+        if (ctx.nbitems) {  // at least one item is already read
+          store_item(ctx, list);
+          if (ctx.stopped)
+            return 1;
+        }
+        ok = read_item(ctx, p1, eol);
+      }
+      else {
+        cerr << "Error parsing " << ctx.file->get_name() << endl;
+        p1 = eol;  // skips the line
+      }
+  }
+  return 0;
+}
+
+//----- Stores the current item into list, or passes it to the visitor ------
+void tDeltaItemList::store_item(tParseCtx & ctx, vector<tItemDescr> & list)
+{
+  size_t nbattr;
+
+  if (ctx.visitor) {  // streaming : the item is not kept
+    if (ctx.charmap)
+      renumber_attributes(ctx.id.attributes, *ctx.charmap);
+    ctx.id.build_index();
+    if (!ctx.visitor->visit(tItemView(ctx.nbitems, ctx.id)))
+      ctx.stopped = 1;
+    ctx.id.attributes.clear();
+    return;
+  }
+  ctx.id.build_index();
+  nbattr = ctx.id.attributes.size();
+  list.push_back(move(ctx.id));
+  // reinit attribute list (moved-from), sized like the previous item
+  ctx.id.attributes.clear();
+  ctx.id.attributes.reserve(nbattr);
+}
+
+//----- Streaming of the items file -----------------------------------------
+int tDeltaItemList::stream_items(tItemVisitor & visitor, const vector<int> *charmap)
+{
+  vector<tItemDescr> none;  // stays empty
+  int ok;
+
+  if (!fitems)
+    return -1;
+  fitems->set_release(1);  // the file is read once
+  if (!fitems->open(AM_READ)) {
+    fitems->set_release(0);
+    cerr << "Unable to open " << fitems->get_name() << endl;
+    return -1;
+  }
+  tParseCtx ctx(fitems, pmr::get_default_resource());
+  ctx.visitor = &visitor;
+  ctx.charmap = charmap;
+  ok = parse_block(ctx, none);
+  fitems->close();
+  fitems->set_release(0);
+  return ok ? ctx.nbitems : -1;
+}
+
+//----- Parallel parsing of a mapped file ---------------------------------
+//        The file is split in blocks beginning with an item (line beginning
+//        with '#'), blocks are parsed by a pool of threads and the results
+//        are merged in file order.
+int tDeltaItemList::parse_parallel(int nbthreads)
+{
+  vector<const char *> bounds;
+  const char *begin, *end, *p;
+  int i, k, n, nbblocks, ok;
+
+  //--- Splitting the file in blocks (several blocks per thread, for load balancing)
+  begin = fitems->get_data();
+  end = fitems->get_data_end();
+  nbblocks = nbthreads * 4;
+  bounds.push_back(begin);
+  for (k=1; k<nbblocks; k++) {
+    p = begin + (end - begin) / nbblocks * k;
+    if (p <= bounds.back())
+      continue;
+    // Searches the next line beginning with '#'
+    while (p < end) {
+      if (*(p-1) == '\n') {
+        while ((p < end) && ((*p==' ')||(*p=='\t')))
+          p++;
+        if ((p < end) && (*p == '#'))
+          break;
+      }
+      p = (const char *) memchr(p, '\n', end - p);
+      p = p ? p+1 : end;
+    }
+    if (p >= end)
+      break;
+    bounds.push_back(p);
+  }
+  bounds.push_back(end);
+  nbblocks = bounds.size() - 1;
+  //--- Parsing the blocks (each block in its own arena, if any)
+  vector<pmr::memory_resource *> resources(nbblocks);
+  for (k=0; k<nbblocks; k++)
+    resources[k] = new_arena(bounds[k+1] - bounds[k]);
+  vector< vector<tItemDescr> > lists(nbblocks);
+  vector< vector<string> > dirs(nbblocks);
+  vector<int> status(nbblocks, 0);
+  vector<thread> pool;
+  atomic<int> next(0);
+  for (i=0; (i<nbthreads) && (i<nbblocks); i++)
+    pool.push_back(thread([&]() {
+      int b;
+      while ((b = next++) < nbblocks) {
+        tDeltaFile block(fitems->get_name(), bounds[b], bounds[b+1]);
+        tParseCtx ctx(&block, resources[b]);
+        ctx.more = (b+1 < nbblocks);
+        status[b] = parse_block(ctx, lists[b]);
+        dirs[b].swap(ctx.directives);
+      }
+    }));
+  for (i=0; i<pool.size(); i++)
+    pool[i].join();
+  //--- Merging the results in file order
+  n = 0;
+  for (k=0; k<nbblocks; k++)
+    n += lists[k].size();
+  item_list.reserve(n);
+  ok = 1;
+  for (k=0; k<nbblocks; k++) {
+    ok &= status[k];
+    item_list.insert(item_list.end(), make_move_iterator(lists[k].begin()),
+                     make_move_iterator(lists[k].end()));
+    directives.insert(directives.end(), dirs[k].begin(), dirs[k].end());
+  }
+  return ok;
+}
+
 //----- Reads one directive -----------------------------------------------
-int tDeltaItemList::read_directive(char *cline, char * & p1)
+int tDeltaItemList::read_directive(tParseCtx & ctx, const char * & p1, const char * & eol)
 {
-  directives.push_back(cline);
-  p1 += strlen(cline);  // moves p1 at end of line
+  ctx.directives.push_back(string(p1, eol));
+  p1 = eol;  // moves p1 at end of line
   return 1;
 }
 
 //----- Reads an item ----------------------------------------------------
-int tDeltaItemList::read_item(char *cline, char * & p1)
+int tDeltaItemList::read_item(tParseCtx & ctx, const char * & p1, const char * & eol)
 {
-  char nbuf[BUFSIZE];  // Item name buffer
-  char *p2;
+  const char *p2;
   int stop=0;
 
-  nbitems++;
+  ctx.nbitems++;
   //----- Extract item name and comment -----
   //--- Skip at begin of item name
   p1++;                              //skip '#'
-  while ((*p1==' ') || (*p1=='\t'))  //skip blank(s) or tab(s)
+  while ((p1 < eol) && ((*p1==' ') || (*p1=='\t')))  //skip blank(s) or tab(s)
     p1++;
-  p2 = nbuf;
+  ctx.nbuf.clear();
   //--- Reading loop
   while (!stop) {
     // If EOL reached --> continue at next line
-    if (!*p1) {
-      if (!fitems->next_line(cline)) {
-        if (!fitems->eof())  // read error
-          cerr << "Error reading " << fitems->get_name() << endl;
+    if (p1 == eol) {
+      if (!ctx.file->next_line(p1, eol)) {
+        if (!ctx.file->eof())  // read error
+          cerr << "Error reading " << ctx.file->get_name() << endl;
         else                 // EOF
-          cerr << "Error parsing " << fitems->get_name() << " : item name without attributes" << endl;
+          cerr << "Error parsing " << ctx.file->get_name() << " : item name without attributes" << endl;
         return 0;
       }
-      p1 = cline;
-      *p2++ = ' ';  // insert blank after line changing
+      ctx.nbuf += ' ';  // insert blank after line changing
     }
     // Item name and comment ends with '/' followed by blank or EOL
-    if ((*p1=='/') && ((!*(p1+1)) || (*(p1+1)==' '))) {   // end of name
-      *p2 = '\x00';
-      id.name = nbuf;
+    p2 = scan_bytes(p1, eol, '/');
+    ctx.nbuf.append(p1, p2 - p1);
+    p1 = p2;
+    if (p1 == eol)
+      continue;
+    if ((p1+1 == eol) || (*(p1+1)==' ')) {   // end of name
+      ctx.id.name = ctx.nbuf;
       stop = 1;
     }
     else  // Continue
-      *p2++ = *p1++;
+      ctx.nbuf += *p1++;
   }  // end while (!stop)
   //----- Moves pointer at end of line or at the begin of next sentence -----
   p1++;
-  while ((*p1==' ')||(*p1=='\t'))
+  while ((p1 < eol) && ((*p1==' ')||(*p1=='\t')))
     p1++;
   //----- Reads the item's attributes -----
-  return read_attributes(cline, p1);
+  return read_attributes(ctx, p1, eol);
 }
 
 //----- Reads item attributes -----------------------------------------------
-int tDeltaItemList::read_attributes(char *cline, char * & p1)
+int tDeltaItemList::read_attributes(tParseCtx & ctx, const char * & p1, const char * & eol)
 {
-  char buf[BUFSIZE];
-  char *p2;
   int stop;
 
-  p2 = buf;
+  ctx.abuf.clear();
   stop = 0;
   //--- Reading item attributes
   while (!stop) {
     // If EOL reached --> continue at next line
-    if (!*p1) {
-      if (!fitems->next_line(cline)) {
-        if (!fitems->eof()) {
-          cerr << "Error reading " << fitems->get_name() << endl;
+    if (p1 == eol) {
+      if (!ctx.file->next_line(p1, eol)) {
+        if (!ctx.file->eof()) {
+          cerr << "Error reading " << ctx.file->get_name() << endl;
           return 0;
         }
         else {   // end of file
-          *p2 = '\x00';
-          if (*buf)
-            return extract_attributes(buf);  // Extract attributes
-          return 0;
+          if (ctx.abuf.size())
+            return extract_attributes(ctx, &ctx.abuf[0], &ctx.abuf[0] + ctx.abuf.size());
+          // end of a block followed by an item : item without attributes,
+          // as in the whole file
+          return ctx.more;
         }
       }
-      p1 = cline;
       // Items attributes ends at next item name (line beginning with #)
-      if (*p1=='#') {
-        *p2 = '\x00';
+      if (*p1=='#')
         stop = 1;
-      }
       else
-        *p2++ = ' ';  // insert blank after line changing
-    }   // if (!*p1)
-    else  // Continue
-      *p2++ = *p1++;
+        ctx.abuf += ' ';  // insert blank after line changing
+    }   // if (p1 == eol)
+    else {  // Continue : copy the rest of the line
+      ctx.abuf.append(p1, eol - p1);
+      p1 = eol;
+    }
   }
   //--- Extract attributes
-  return extract_attributes(buf);
+  return extract_attributes(ctx, &ctx.abuf[0], &ctx.abuf[0] + ctx.abuf.size());
 }
 
 //----- Extract attributes from attribute list --------------------------------
-int tDeltaItemList::extract_attributes(char *attrlst)
+int tDeltaItemList::extract_attributes(tParseCtx & ctx, char *attrlst, char *end)
 {
-  tAttrDescr ad;
-  char buf[BUFSIZE];
-  char *p1, *p2;
+  char *p1, *attr;
   int comment;
 
-  p1 = attrlst;
-  p2 = buf;
+  p1 = attr = attrlst;
   comment = 0;
-  while (*p1) {
+  while (p1 < end) {
+    //--- Next blank or comment bracket
+    p1 = (char *) scan_bytes(p1, end, ' ', '<', '>');
+    if (p1 == end)
+      break;
     //--- Blank (separator) --> end of the currrent attribute
     if ((*p1 == ' ') && (!comment)) {	// blanks in comment are ignored
-      *p2 = '\x00';
-      if (*buf) {   // ignore blank lines
-        //--- Store attribute
-        ad.parse_attr(buf);             // parse attribute
-        id.attributes.push_back(ad);    // storing attribute
-        p2 = buf;
+      if (p1 > attr) {   // ignore blank lines
+        //--- Store attribute (parsed in place)
+        *p1 = '\x00';
+        ctx.id.attributes.emplace_back();
+        ctx.id.attributes.back().parse_attr(attr, ctx.pbuf, lazy);
       }
+      attr = p1 + 1;
     }
-    //--- Other characters (comments included) are copied into the buffer
+    //--- Brackets (comments are kept in the attribute)
     else {
       if (*p1 == '<')   // comment begin (nested comments are allowed)
         comment++;
       if ((*p1 == '>') && comment)   // comment end
         comment--;
-      *p2 = *p1;
-      p2++;
     }
     p1++;   // next char
   }
   //--- Store last attribute
-  *p2 = '\x00';
-  if (*buf) {   // ignore blank lines
-    ad.parse_attr(buf);             // parse attribute
-    id.attributes.push_back(ad);    // storing attribute
+  if (end > attr) {   // ignore blank lines
+    *end = '\x00';
+    ctx.id.attributes.emplace_back();
+    ctx.id.attributes.back().parse_attr(attr, ctx.pbuf, lazy);
   }
   return 1;
 }
@@ -856,16 +2627,13 @@ int tDeltaItemList::extract_attributes(char *attrlst)
 //===== tAttrDescr ============================================================
 
 //----- Extract comments (delimited by < >) from a string ---------------------
-int tAttrDescr::extract_comment(char * & src, char *dest, int lmax)
+int tAttrDescr::extract_comment(const char * & src, string & dest) const
 {
-  char *p1;
-  int i;
   int comment=0;
 
   //--- Initialisation
   src++;  // skip '<'
-  p1 = dest;
-  i = 1;
+  dest.clear();
   //--- Reading loop
   while (*src) {
     if (*src == '<')   // begin of a nested comment
@@ -875,12 +2643,9 @@ int tAttrDescr::extract_comment(char * & src, char *dest, int lmax)
         comment--;
       else
         break;         // end main comment --> exit
-    if (i < lmax)
-      *p1 = *src;
-    src++; p1++;
-    i++;
+    dest += *src;
+    src++;
   }
-  *p1= 0;
   //--- Ending
   if (!*src) {
     cerr << "Parse error : end of comment character '>' missing" << endl;
@@ -892,14 +2657,20 @@ int tAttrDescr::extract_comment(char * & src, char *dest, int lmax)
 }
 
 //----- Parses an attribute ---------------------------------------------------
-int tAttrDescr::parse_attr(char *attr)
+int tAttrDescr::parse_attr(const char *attr)
+{
+  string buf;
+
+  return parse_attr(attr, buf);
+}
+
+int tAttrDescr::parse_attr(const char *attr, string & buf, int lazy)
 {
-  tAltDescr altd;
-  char buf[BUFSIZE];
-  char *p1, *p2;
+  const char *p1;
 
   //--- Clear previous data
-  alternatives.erase(alternatives.begin(), alternatives.end());
+  alternatives.clear();
+  pending.store(0, memory_order_relaxed);
   comment = "";
   alt = "";
   p1 = attr;
@@ -909,35 +2680,46 @@ int tAttrDescr::parse_attr(char *attr)
     p1++;
   //--- Extract character comment
   if (*p1 == '<') {
-    if (!extract_comment(p1, buf, BUFSIZE))
+    if (!extract_comment(p1, buf))
       return 0;
     comment = buf;
   }
   if (!*p1)
     return 0;  // Character without alternatives
   p1++;  // skip ','
-  //--- Extract alternatives
+  //--- Extract alternatives (or only keep them for a lazy parsing)
   alt = p1;
+  if (lazy) {
+    pending.store(1, memory_order_relaxed);
+    return 1;
+  }
+  return parse_alternatives(p1, buf, alternatives);
+}
+
+//----- Decodes the alternatives from the alternative list --------------------
+int tAttrDescr::parse_alternatives(const char *p1, string & buf,
+                                   pmr::vector<tAltDescr> & list) const
+{
+  const char *p2;
+
   while (*p1) {
-    // Copying an alternative into buf
-    p2 = buf;
-    while ((*p1) && (*p1 != '<') && (*p1 != '/')) {
-      *p2 = *p1;
-      p2++; p1++;
-    }
-    *p2 = 0;
+    // Alternative span [p2, p1[
+    p2 = p1;
+    while ((*p1) && (*p1 != '<') && (*p1 != '/'))
+      p1++;
+    // The alternative is built in place at the end of the list
+    list.emplace_back();
+    tAltDescr & altd = list.back();
     // Parse it (extract value list)
-    altd.parse_alternative(buf);
+    altd.parse_alternative(p2, p1);
     // Extract alternative comment
     if (*p1 == '<') {
-      if (!extract_comment(p1, buf, BUFSIZE))
+      if (!extract_comment(p1, buf)) {
+        list.pop_back();  // incomplete alternative is not stored
         return 0;
-      altd.set_comment(buf);
+      }
+      altd.set_comment(buf.c_str());
     }
-    else
-      altd.set_comment("");  // deletes previous comment
-    // Store the alternative into alternative list
-    alternatives.push_back(altd);
     // Go to next alternative
     if (*p1)
       p1++;      // skip '/'
@@ -945,11 +2727,61 @@ int tAttrDescr::parse_attr(char *attr)
   return 1;
 }
 
+//----- Decoding of the alternatives of a lazy parsing --------------------------
+//        The alternatives are decoded without lock in a list of the default
+//        resource, then stored under a lock; the flag is cleared only once
+//        the alternatives are complete. Attributes are spread over a small
+//        set of locks. An arena (monotonic_buffer_resource) is not
+//        thread-safe : all the attributes allocated in the same arena share
+//        its lock, which is held only for the copy into the arena.
+static mutex decode_locks[64];
+
+void tAttrDescr::decode_pending(void) const
+{
+  string buf;
+  pmr::vector<tAltDescr> list;
+  pmr::memory_resource *mr = alternatives.get_allocator().resource();
+  size_t key = (mr == pmr::get_default_resource()) ? (size_t) this : (size_t) mr;
+
+  parse_alternatives(alt.c_str(), buf, list);
+  lock_guard<mutex> lock(decode_locks[(key >> 6) & 63]);
+  if (!pending.load(memory_order_relaxed))
+    return;  // decoded by another thread meanwhile
+  if (alternatives.get_allocator() == list.get_allocator())
+    alternatives.swap(list);
+  else
+    alternatives.assign(make_move_iterator(list.begin()), make_move_iterator(list.end()));
+  pending.store(0, memory_order_release);
+}
+
+//----- Assignments -------------------------------------------------------------
+tAttrDescr & tAttrDescr::operator = (const tAttrDescr & ad)
+{
+  charnum = ad.charnum;
+  pending.store(ad.pending.load());
+  comment = ad.comment;
+  alternatives = ad.alternatives;
+  alt = ad.alt;
+  return *this;
+}
+
+tAttrDescr & tAttrDescr::operator = (tAttrDescr && ad)
+{
+  charnum = ad.charnum;
+  pending.store(ad.pending.load());
+  comment = std::move(ad.comment);
+  alternatives = std::move(ad.alternatives);
+  alt = std::move(ad.alt);
+  return *this;
+}
+
 //----- Browses alternatives list and makes value(s) comparison ---------------
-int tAttrDescr::compare(double *values, int nbval, int strict, int with_extrval)
+int tAttrDescr::compare(const double *values, int nbval, int strict,
+                        int with_extrval) const
 {
   int i, res;
 
+  decode();
   res = 0;
   for (i=0; (i < alternatives.size()) && (!res); i++)
     res = alternatives[i].compare(values, nbval, strict, with_extrval);
@@ -957,123 +2789,216 @@ int tAttrDescr::compare(double *values, int nbval, int strict, int with_extrval)
 }
 
 
+//----- Storing the attribute in the parse cache -------------------------------
+void tAttrDescr::save_cache(tParseCache & cache) const
+{
+  int i;
+
+  cache.put_int(charnum);
+  cache.put_string(comment);
+  cache.put_string(alt);
+  cache.put_int(is_decoded());
+  if (!is_decoded())   // lazy parsing : decoded after loading
+    return;
+  cache.put_int(alternatives.size());
+  for (i=0; i<alternatives.size(); i++)
+    alternatives[i].save_cache(cache);
+}
+
+//----- Loading the attribute from the parse cache ----------------------------
+int tAttrDescr::load_cache(tParseCache & cache)
+{
+  int i, n, ok;
+
+  charnum = cache.get_int();
+  cache.get_string(comment);
+  cache.get_string(alt);
+  alternatives.clear();
+  pending.store(0, memory_order_relaxed);
+  if (!cache.get_int()) {   // alternatives not decoded
+    pending.store(1, memory_order_relaxed);
+    return 1;
+  }
+  n = cache.get_count();
+  alternatives.resize(n > 0 ? n : 0);
+  ok = (n >= 0);
+  for (i=0; (i<alternatives.size()) && ok; i++)
+    ok = alternatives[i].load_cache(cache);
+  return ok;
+}
+
+
 //===== tAltDescr =============================================================
 
 //----- Parses an attribute ---------------------------------------------------
-int tAltDescr::parse_alternative(char *altstr)
+int tAltDescr::parse_alternative(const char *altstr)
+{
+  return parse_alternative(altstr, altstr + strlen(altstr));
+}
+
+int tAltDescr::parse_alternative(const char *p, const char *end, const char **stop)
 {
-  char *p;
   double x;
+  int ok;
 
   //--- Initialisation
   // Clear previous data
-  value_list.values.erase(value_list.values.begin(), value_list.values.end());
+  value_list.values.clear();
   value_list.val_rel = value_list.extr_val = 0;
-  p = altstr;
+  ok = 1;
   //--- Reading special values
-  switch (*p) {
-    case 'V' :
-      value_list.values.push_back(VARIABLE);
-      return 1;
-    case 'U' :
-      value_list.values.push_back(UNKNOWN);
-      return 1;
-    case '-' :
-      value_list.values.push_back(NOTAPPLI);
-      return 1;
-  }
+  if (p < end)
+    switch (*p) {
+      case 'V' :
+        value_list.values.push_back(VARIABLE);
+        p = end;
+        break;
+      case 'U' :
+        value_list.values.push_back(UNKNOWN);
+        p = end;
+        break;
+      case '-' :
+        value_list.values.push_back(NOTAPPLI);
+        p = end;
+        break;
+    }
   //--- Reading first value
   // Case of extreme low value
-  if (*p == '(') {
-    p++;    // skip (
-    x = atof(p);
+  if ((p < end) && (*p == '(')) {
+    p = span_atof(p+1, end, x);   // skip (
     value_list.values.push_back(x);
     value_list.extr_val = EXTRVAL_LOW;
     value_list.val_rel  = '-';
-    while ((*p) && (*p != ')'))
+    while ((p < end) && (*p != ')'))
       p++;
-    if (*p == ')')
+    if (p < end)
       p++;  // skip )
-    if (!*p) {
-      return 0;
-    }
+    if (p == end)
+      ok = 0;
   }
-  // First "normal" value
-  x = atof(p);
-  value_list.values.push_back(x);
-  while ((*p) && ((*p != '-') && (*p != '&') && (*p != '(')))
-    p++;
-  if (!*p)
-    return 1;
-  if (*p != '(') {
-    value_list.val_rel = *p;
-    p++;
+  if ((p < end) || (ok && value_list.values.empty())) {
+    // First "normal" value
+    p = span_atof(p, end, x);
+    value_list.values.push_back(x);
+    while ((p < end) && ((*p != '-') && (*p != '&') && (*p != '(')))
+      p++;
+    if ((p < end) && (*p != '(')) {
+      value_list.val_rel = *p;
+      p++;
+    }
   }
   //--- Reading next values
-  while (*p) {
+  while (p < end) {
     if (*p == '(') {    // case of extreme high value
-      p++; p++;   // skip ( and -
-      x = atof(p);
+      p++;              // skip (
+      if (p < end)
+        p++;            // skip -
+      p = span_atof(p, end, x);
       value_list.values.push_back(x);
       value_list.extr_val |= EXTRVAL_HIGH;
       value_list.val_rel  = '-';
+      if ((p < end) && (*p == ')'))
+        p++;  // skip )
       break;
     }
-    x = atof(p);
+    p = span_atof(p, end, x);
     value_list.values.push_back(x);
-    while ((*p) && ((*p != value_list.val_rel) && (*p != '(')))
+    while ((p < end) && ((*p != value_list.val_rel) && (*p != '(')))
       p++;
-    if (*p == value_list.val_rel)
+    if ((p < end) && (*p == value_list.val_rel))
       p++;
   }
-  return 1;
+  if (stop)
+    *stop = p;
+  return ok;
+}
+
+//----- Storing the alternative in the parse cache -----------------------------
+void tAltDescr::save_cache(tParseCache & cache) const
+{
+  int i;
+
+  cache.put_string(comment);
+  cache.put_int(value_list.val_rel);
+  cache.put_int(value_list.extr_val);
+  cache.put_int(value_list.values.size());
+  for (i=0; i<value_list.values.size(); i++)
+    cache.put_double(value_list.values[i]);
+}
+
+//----- Loading the alternative from the parse cache ---------------------------
+int tAltDescr::load_cache(tParseCache & cache)
+{
+  int i, n;
+
+  cache.get_string(comment);
+  value_list.val_rel = cache.get_int();
+  value_list.extr_val = cache.get_int();
+  n = cache.get_count();
+  value_list.values.resize(n > 0 ? n : 0);
+  for (i=0; i<value_list.values.size(); i++)
+    value_list.values[i] = cache.get_double();
+  return (n >= 0);
 }
 
 //----- Comparison between alternative values and given value(s) --------------
-int tAltDescr::compare(double *values, int nbval, int strict, int with_extrval)
+int tAltDescr::compare(const double *values, int nbval, int strict,
+                       int with_extrval) const
+{
+  return compare_values(value_list.values.data(), value_list.values.size(),
+                        value_list.val_rel, value_list.extr_val,
+                        values, nbval, strict, with_extrval);
+}
+
+//----- Comparison between an alternative values list and given value(s) -------
+int tAltDescr::compare_values(const double *alt_values, int alt_nb, char val_rel,
+                              int extr_val, const double *values, int nbval,
+                              int strict, int with_extrval)
 {
   int first, last, i, j, res;
 
+  if (!alt_nb)
+    return 0;
   //----- Unique value to compare
-  if (!value_list.val_rel) {
-    if (value_list.values[0] == VARIABLE)
+  if (!val_rel) {
+    if (alt_values[0] == VARIABLE)
       return 1;
-    if (value_list.values[0] == UNKNOWN)
+    if (alt_values[0] == UNKNOWN)
       if (strict)
         return 0;
       else
         return 1;
-    if (value_list.values[0] == NOTAPPLI)
+    if (alt_values[0] == NOTAPPLI)
       return 0;
-    return (*values == value_list.values[0]);
+    return (*values == alt_values[0]);
   }
   //----- Several values to compare with relation AND
-  if (value_list.val_rel == '&') {
+  if (val_rel == '&') {
     first = 0;
-    last = value_list.values.size()-1;
+    last = alt_nb-1;
     for (i=first; i<=last; i++) {
       res = 0;
       for (j=0; j<nbval; j++)
-        res |= (value_list.values[i] == values[j]);
+        res |= (alt_values[i] == values[j]);
       if (!res)
         break;
     }
     return res;
   }
   //----- Several values to compare with relation TO
-  if (value_list.val_rel == '-') {
+  if (val_rel == '-') {
     first = 0;
-    last = value_list.values.size()-1;
+    last = alt_nb-1;
     if (!with_extrval) {
-      if (value_list.extr_val && EXTRVAL_LOW)
+      if (extr_val & EXTRVAL_LOW)
         first++;
-      if (value_list.extr_val && EXTRVAL_HIGH)
+      if (extr_val & EXTRVAL_HIGH)
         last--;
     }
     res = 1;
     for (i=0; i<nbval; i++)
-      res &= ((values[i] >= value_list.values[first]) &&
-              (values[i] <= value_list.values[last]));
+      res &= ((values[i] >= alt_values[first]) &&
+              (values[i] <= alt_values[last]));
     return res;
   }
   return 0;
@@ -1089,7 +3014,11 @@ int tAltDescr::compare(double *values, int nbval, int strict, int with_extrval)
 tDeltaSpecs::tDeltaSpecs(void)
 {
   fspecs = NULL;
+  impl_val = NULL;
+  chars = NULL;
+  items = NULL;
   parsed = 0;
+  listed = 0;
 }
 
 tDeltaSpecs::tDeltaSpecs(const char *fname, tDeltaCharList *_chars, tDeltaItemList *_items, int parse)
@@ -1097,9 +3026,10 @@ tDeltaSpecs::tDeltaSpecs(const char *fname, tDeltaCharList *_chars, tDeltaItemLi
   fspecs = new tDeltaFile(fname);
   chars = _chars;
   items = _items;
-  impl_val = new tImplVal [chars->get_chars_nb()];
+  impl_val = NULL;   // allocated when parsing (the characters list may be not yet parsed)
   //--- Parsing
   parsed = 0;
+  listed = 0;
   if (parse)
     parse_specs();
 }
@@ -1109,13 +3039,8 @@ tDeltaSpecs::tDeltaSpecs(const char *fname, tDeltaCharList *_chars, tDeltaItemLi
 
 tDeltaSpecs::~tDeltaSpecs(void)
 {
-  int n, i;
-
   delete fspecs;
-  delete impl_val;
-  n = char_dep.size();
-  for (i=0; i<n; i++)
-    delete char_dep[i].dc;
+  delete [] impl_val;
 }
 
 
@@ -1124,70 +3049,185 @@ tDeltaSpecs::~tDeltaSpecs(void)
 //----- Parse the specifications file -----------------------------------------
 int tDeltaSpecs::parse_specs(void)
 {
-  char cline[LMAXLINE];
-  char buf[BUFSIZE];
-  char *p1;
-  int i, n, ok;
+  int i, n;
 
-  //--- Test if specifications file exist ---
-  if (!fspecs)
+  parsed = 0;
+  //--- Specifications list (unless already read by read_specs) ---
+  if (!listed && !read_specs())
     return 0;
+  listed = 0;
   //--- Reset data from previous parsing ---
-  // Specifications list
-  n = specs_list.size();
-  if (n)
-    specs_list.erase(specs_list.begin(), specs_list.end());
   // Character dependencies
-  n = char_dep.size();
-  if (n) {
-    for (i=0; i<n; i++)
-      delete char_dep[i].dc;
-    char_dep.erase(char_dep.begin(), char_dep.end());
-  }
+  char_dep.clear();
+  dep_index.clear();
   //--- Init implicit values table ---
   n = chars->get_chars_nb();
+  delete [] impl_val;
+  impl_val = new tImplVal [n];
   for (i=0; i<n; i++)
     impl_val[i].iv1 = impl_val[i].iv2 = 0;
+  //--- End parsing ---
+  parsed = 1;
+  return parse_specs_detail();
+}
+
+//----- Reads the specifications list -----------------------------------------
+int tDeltaSpecs::read_specs(void)
+{
+  const char *p1, *eol;
+  unsigned long long key;
+  int ok;
+
+  //--- Test if specifications file exist ---
+  if (!fspecs)
+    return 0;
+  //--- Reset data from previous reading ---
+  specs_list.clear();
+  dir_table.clear();
+  listed = 0;
+  //--- Specifications list in the cache ---
+  key = 0;
+  if (cache_dir.size() && (key = tParseCache::file_key(fspecs->get_name(), "specs"))) {
+    tParseCache cache;
+    if (cache.load(cache_dir, key) && load_cache(cache)) {
+      dir_table.add(specs_list);
+      listed = 1;
+      return 1;
+    }
+  }
   //--- Open the file ---
   if (!fspecs->open(AM_READ)) {
     cerr << "Unable to open " << fspecs->get_name() << endl;
     return 0;
   }
-  *buf = '\x0';
+  sbuf.clear();
   //--- Reading loop ---
   while (1) {
-      ok = fspecs->next_line(cline);
+      ok = fspecs->next_line(p1, eol);
       if (!ok) {
         //--- End of file or error ---
         if (!fspecs->eof()) {
           cerr << "Error reading " << fspecs->get_name() << endl;
           return 0;
         }
-        if (*buf)   // at least one specification is already read
-          specs_list.push_back(buf);  // Store the last specification read
-        //--- End parsing ---
-        parsed = 1;
-        return parse_specs_detail();
+        if (sbuf.size())   // at least one specification is already read
+          specs_list.push_back(sbuf);  // Store the last specification read
+        fspecs->close();
+        if (key) {
+          tParseCache cache;
+          save_cache(cache);
+          cache.store(cache_dir, key);
+        }
+        //--- End reading ---
+        dir_table.add(specs_list);
+        listed = 1;
+        return 1;
       }
     //--- Processing the line ---
-    if (*cline == '*') {  // new specification
-      if (*buf)   // at least one specification is already read
-        specs_list.push_back(buf);  // Store the last specification read
-      strcpy(buf, cline+1);
+    if (*p1 == '*') {  // new specification
+      if (sbuf.size())   // at least one specification is already read
+        specs_list.push_back(sbuf);  // Store the last specification read
+      sbuf.assign(p1+1, eol - (p1+1));
     }
     else {           // additional specification line
-      p1 = cline;
-      while ((*p1==' ')||(*p1=='\t'))  // skip blank and tab at begin of line
-        p1++;
-      if ((*p1) && (*buf)) {
-        strcat(buf, " ");    // separator
-        strcat(buf, p1);
+      // (blank and tab at begin of line already skipped)
+      if (sbuf.size()) {
+        sbuf += ' ';    // separator
+        sbuf.append(p1, eol - p1);
       }
     }
   }  // while (1)
   return 0;
 }
 
+//----- Declared numbers of states ---------------------------------------------
+//        "NUMBERS OF STATES c,n c1-c2,n ..." : characters which are not listed
+//        get the maximum number of states (0 if not declared)
+//        The declared number of characters is accepted up to 'maxchars';
+//        beyond it (or beyond 'maxchars' if not declared), nothing is
+//        declared. Ranges are limited to the accepted number of characters.
+void tDeltaSpecs::get_declared_states(vector<int> & nbstates, int maxchars) const
+{
+  const char *p1;
+  int n1, n2, ns, max, nbchars, i;
+  string spec;
+
+  nbstates.clear();
+  max = dir_table.get_int("MAXIMUM NUMBER OF STATES");
+  spec = dir_table.get("NUMBERS OF STATES");
+  if ((max < 0) || (!max && spec.empty()))
+    return;
+  nbchars = dir_table.get_int("NUMBER OF CHARACTERS");
+  if ((nbchars < 0) || (nbchars > maxchars))
+    return;  // not plausible : nothing declared
+  if (!nbchars)
+    nbchars = maxchars;
+  else
+    nbstates.assign(nbchars, max);
+  p1 = spec.c_str();
+  while (*p1) {
+    while (*p1==' ' || *p1=='\t')  // skip blanks and tabs
+      p1++;
+    if (!*p1)  // end of line
+      return;
+    //--- Reading character number (or range)
+    n1 = atoi(p1);
+    while (*p1>='0' && *p1<='9')
+      p1++;
+    if (*p1=='-') {
+      p1++;
+      n2 = atoi(p1);
+      while (*p1>='0' && *p1<='9')
+        p1++;
+    }
+    else
+      n2 = n1;
+    if ((*p1 != ',') || (n1 < 1) || (n2 < n1)) {
+      nbstates.clear();  // not understood : nothing declared
+      return;
+    }
+    //--- Reading number of states
+    p1++;
+    ns = atoi(p1);
+    while (*p1>='0' && *p1<='9')
+      p1++;
+    if (max && (ns > max))
+      ns = max;
+    if (n2 > nbchars)
+      n2 = nbchars;  // out of range : ignored
+    if (n2 > nbstates.size())
+      nbstates.resize(n2, max);
+    for (i=n1; i<=n2; i++)
+      nbstates[i-1] = ns;
+  }
+}
+
+//----- Storing the specifications list in the parse cache --------------------
+void tDeltaSpecs::save_cache(tParseCache & cache)
+{
+  int i;
+
+  cache.put_int(specs_list.size());
+  for (i=0; i<specs_list.size(); i++)
+    cache.put_string(specs_list[i]);
+}
+
+//----- Loading the specifications list from the parse cache ------------------
+int tDeltaSpecs::load_cache(tParseCache & cache)
+{
+  int i, n;
+
+  n = cache.get_count();
+  specs_list.resize(n > 0 ? n : 0);
+  for (i=0; i<specs_list.size(); i++)
+    cache.get_string(specs_list[i]);
+  if (!cache.is_complete()) {
+    specs_list.clear();
+    return 0;
+  }
+  return 1;
+}
+
 //----- Set or change the specifications filename -----------------------------
 void tDeltaSpecs::set_filename(const char *fname, int parse)
 {
@@ -1195,6 +3235,7 @@ void tDeltaSpecs::set_filename(const char *fname, int parse)
     delete fspecs;
   fspecs = new tDeltaFile(fname);
   parsed = 0;
+  listed = 0;
   if (parse)
     parse_specs();
 }
@@ -1232,54 +3273,26 @@ int tDeltaSpecs::get_implicit_value(int charnum, int iv_type)
 //        for a given control character and state -----------------------------
 int tDeltaSpecs::get_depchar_nb(int ccnum, int ccstate)
 {
-  int st, i;
-
-  if ((ccnum < 1) || (ccnum > chars->get_chars_nb())) {
-    cerr << "tDeltaSpecs::get_depchar_nb() : ccnum parameter out of range" << endl;
-    return 0;
-  }
-  if ((ccstate < 1) || (ccstate > sizeof(int))) {
-    cerr << "tDeltaSpecs::get_depchar_nb() : ccstate parameter out of range" << endl;
-    return 0;
-  }
-  st = 1 << (ccstate-1);
-  for (i=0; i<char_dep.size(); i++)
-    if ((char_dep[i].cc == ccnum) && (char_dep[i].st & st))
-      return char_dep[i].dcnb;
-  return 0;
+  const tCharDep *d;
+
+  d = find_dep(ccnum, ccstate, "get_depchar_nb");
+  return d ? d->dcnb : 0;
 }
 
 //----- Retrieves a dependent character (in 'rank' position)
 //        for a given control character and state -----------------------------
 int tDeltaSpecs::get_depchar(int ccnum, int ccstate, int rank)
 {
-  int st, i, j, n, m;
+  const tCharDep *d;
+  int j, n;
 
-  if ((ccnum < 1) || (ccnum > chars->get_chars_nb())) {
-    cerr << "tDeltaSpecs::get_depchar() : ccnum parameter out of range" << endl;
-    return 0;
-  }
-  if ((ccstate < 1) || (ccstate > sizeof(int))) {
-    cerr << "tDeltaSpecs::get_depchar() : ccstate parameter out of range" << endl;
+  d = find_dep(ccnum, ccstate, "get_depchar");
+  if (!d || (rank < 1) || (rank > d->dcnb))
     return 0;
-  }
-  st = 1 << (ccstate-1);
-  m = chars->get_chars_nb();
-  for (i=0; i<char_dep.size(); i++)
-    if ((char_dep[i].cc == ccnum) && (char_dep[i].st & st)) {
-      if ((rank >= 1) && (rank <= char_dep[i].dcnb)) {
-        n = 0;
-        for (j=0; j<m; j++) {
-          if (char_dep[i].dc[j] == '1') {
-            n++;
-            if (n == rank)
-              return (j+1);
-          }
-        }
-      }
-      else
-        return 0;
-    }
+  n = 0;
+  for (j=d->dc.first(); j; j=d->dc.next(j))
+    if (++n == rank)
+      return j;
   return 0;
 }
 
@@ -1288,28 +3301,125 @@ int tDeltaSpecs::get_depchar(int ccnum, int ccstate, int rank)
 //        a given control character and state ---------------------------------
 int tDeltaSpecs::is_dependent(int dcnum, int ccnum, int ccstate)
 {
-  int st, i, j, n, m;
+  const tCharDep *d;
 
-  if ((ccnum < 1) || (ccnum > chars->get_chars_nb())) {
-    cerr << "tDeltaSpecs::is_dependent() : ccnum parameter out of range" << endl;
-    return 0;
-  }
   if ((dcnum < 1) || (dcnum > chars->get_chars_nb())) {
     cerr << "tDeltaSpecs::is_dependent() : dcnum parameter out of range" << endl;
     return 0;
   }
-  if ((ccstate < 1) || (ccstate > sizeof(int))) {
-    cerr << "tDeltaSpecs::is_dependent() : ccstate parameter out of range" << endl;
-    return 0;
+  d = find_dep(ccnum, ccstate, "is_dependent");
+  return d ? d->dc.contains(dcnum) : 0;
+}
+
+//----- Dependent characters of a control character and state -----------------
+const tItemSet * tDeltaSpecs::get_depchars(int ccnum, int ccstate)
+{
+  const tCharDep *d;
+
+  d = find_dep(ccnum, ccstate, "get_depchars");
+  return d ? &d->dc : NULL;
+}
+
+//----- Characters made inapplicable by a specimen description -----------------
+int tDeltaSpecs::inapplicable_chars(const tSpecimen & specimen, tItemSet & inapplicable)
+{
+  vector<int> pending;
+  tItemSet dc;
+  const tCharDep *d;
+  int i, j, c, n, st;
+
+  n = chars->get_chars_nb();
+  inapplicable.resize(n);
+  //--- Dependent characters of the control characters values
+  for (i=0; i<specimen.size(); i++) {
+    const tCriterion & cr = specimen[i];
+    c = cr.charnum;
+    if ((c < 1) || (c > dep_index.size()) || dep_index[c-1].empty() || cr.values.empty())
+      continue;
+    // characters depending on each value (state) of the control character
+    for (j=0; j<cr.values.size(); j++) {
+      st = (int) cr.values[j];
+      if ((st != cr.values[j]) || (st < 1) || (st > dep_index[c-1].size()) ||
+          !dep_index[c-1][st-1]) {
+        d = NULL;
+        break;
+      }
+      d = &char_dep[dep_index[c-1][st-1]-1];
+      if (!j)
+        dc = d->dc;
+      else
+        dc &= d->dc;
+    }
+    if (d)
+      inapplicable |= dc;
   }
-  st = 1 << (ccstate-1);
-  for (i=0; i<char_dep.size(); i++)
-    if ((char_dep[i].cc == ccnum) && (char_dep[i].st & st))
-      return (char_dep[i].dc[dcnum-1] == '1');
-  return 0;
+  //--- Characters depending on inapplicable characters (for any state)
+  for (c=inapplicable.first(); c; c=inapplicable.next(c))
+    pending.push_back(c);
+  while (pending.size()) {
+    c = pending.back();
+    pending.pop_back();
+    if (c > dep_index.size())
+      continue;
+    for (st=0, i=0; st<dep_index[c-1].size(); st++) {
+      if (!dep_index[c-1][st] || (dep_index[c-1][st] == i))
+        continue;  // no dependency, or the same as the previous state
+      i = dep_index[c-1][st];
+      dc = char_dep[i-1].dc;  // new inapplicable characters
+      dc -= inapplicable;
+      inapplicable |= dc;
+      for (j=dc.first(); j; j=dc.next(j))
+        pending.push_back(j);
+    }
+  }
+  return inapplicable.count();
 }
 
 
+//----- Removes excluded characters from implicit values and dependencies -----
+void tDeltaSpecs::renumber_characters(const vector<int> &charmap)
+{
+  tImplVal *iv;
+  tItemSet dc;
+  int i, j, k, n, m;
+
+  //--- Implicit values table
+  n = chars->get_chars_nb();
+  m = 0;
+  for (i=1; i<=n; i++)
+    if ((i < charmap.size()) && charmap[i])
+      m++;
+  if (impl_val) {
+    iv = new tImplVal [m];
+    for (i=1; i<=n; i++)
+      if ((i < charmap.size()) && charmap[i])
+        iv[charmap[i]-1] = impl_val[i-1];
+    delete [] impl_val;
+    impl_val = iv;
+  }
+  //--- Character dependencies
+  for (i=0, k=0; i<char_dep.size(); i++) {
+    if ((char_dep[i].cc < charmap.size()) && charmap[char_dep[i].cc]) {
+      dc.resize(m);
+      char_dep[i].cc = charmap[char_dep[i].cc];
+      char_dep[i].dcnb = 0;
+      for (j=char_dep[i].dc.first(); j; j=char_dep[i].dc.next(j))
+        if ((j < charmap.size()) && charmap[j]) {
+          dc.add(charmap[j]);
+          char_dep[i].dcnb++;
+        }
+      swap(char_dep[i].dc, dc);
+      if (char_dep[i].dcnb) {  // keeps dependencies with remaining dependent characters
+        if (k != i)
+          swap(char_dep[k], char_dep[i]);
+        k++;
+      }
+    }
+  }
+  char_dep.erase(char_dep.begin()+k, char_dep.end());
+  index_dependencies();
+}
+
 // For debugging
 void tDeltaSpecs::retrieve_all(void)
 {
@@ -1330,14 +3440,12 @@ void tDeltaSpecs::retrieve_all(void)
   cout << "----------------------" << endl;
   for (i=0; i<char_dep.size(); i++) {
     cout << "Control character " << char_dep[i].cc << ", state(s) ";
-    for (j=0; j<sizeof(int); j++)
-      if (char_dep[i].st & (1 << j))
-        cout << (j+1) << " ";
+    for (j=0; j<char_dep[i].st.size(); j++)
+      cout << char_dep[i].st[j] << " ";
     cout << endl;
     cout << "  Dependent character(s) : ";
-    for (j=0; j<n; j++)
-      if (char_dep[i].dc[j] == '1')
-          cout << (j+1) << " ";
+    for (j=char_dep[i].dc.first(); j; j=char_dep[i].dc.next(j))
+      cout << j << " ";
     cout << endl;
   }
 }
@@ -1365,9 +3473,49 @@ int tDeltaSpecs::parse_specs_detail(void)
       parse_char_dependencies(ch);
     }
   }
+  index_dependencies();
   return 1;
 }
 
+//----- Lookup table of the dependencies --------------------------------------
+//        (the first dependency of a control character and state is used)
+void tDeltaSpecs::index_dependencies(void)
+{
+  int i, j, n;
+
+  dep_index.assign(chars->get_chars_nb(), vector<int>());
+  for (i=0; i<char_dep.size(); i++) {
+    if ((char_dep[i].cc < 1) || (char_dep[i].cc > dep_index.size()))
+      continue;
+    vector<int> & states = dep_index[char_dep[i].cc-1];
+    for (j=0; j<char_dep[i].st.size(); j++) {
+      n = char_dep[i].st[j];
+      if (n > states.size())
+        states.resize(n, 0);
+      if (!states[n-1])
+        states[n-1] = i+1;
+    }
+  }
+}
+
+//----- Dependency of a control character and state (NULL if none) ------------
+//        caller = name of the public function, for error messages
+const tDeltaSpecs::tCharDep * tDeltaSpecs::find_dep(int ccnum, int ccstate, const char *caller)
+{
+  if ((ccnum < 1) || (ccnum > chars->get_chars_nb())) {
+    cerr << "tDeltaSpecs::" << caller << "() : ccnum parameter out of range" << endl;
+    return NULL;
+  }
+  if (ccstate < 1) {
+    cerr << "tDeltaSpecs::" << caller << "() : ccstate parameter out of range" << endl;
+    return NULL;
+  }
+  if ((ccnum > dep_index.size()) || (ccstate > dep_index[ccnum-1].size()))
+    return NULL;
+  int i = dep_index[ccnum-1][ccstate-1];
+  return i ? &char_dep[i-1] : NULL;
+}
+
 
 //----- Parses "CHARACTER TYPES" statement ------------------------------------
 void tDeltaSpecs::parse_char_types(const char *ch)
@@ -1478,9 +3626,11 @@ void tDeltaSpecs::parse_implicit_values(const char *ch)
         else
           iv2 = 0;
         // Storing implicit values
-        for (i=n1; i<=n2; i++) {
-          impl_val[i].iv1 = iv1;
-          impl_val[i].iv2 = iv2;
+        for (i=n1; (i<=n2) && (i<=char_nb); i++) {
+          if (i < 1)
+            continue;
+          impl_val[i-1].iv1 = iv1;
+          impl_val[i-1].iv2 = iv2;
         }
     }
     else {
@@ -1500,13 +3650,9 @@ void tDeltaSpecs::parse_char_dependencies(const char *ch)
   const char *p1;
   int char_nb, dc1, dc2, i, n, stop;
   tCharDep cd;  // temporary data structure
-  char *dc_tmp;
 
   //--- Initialisation ---
   char_nb = chars->get_chars_nb();
-  dc_tmp = new char[char_nb+1];
-  memset(dc_tmp, '0', char_nb);
-  dc_tmp[char_nb] = '\0';
   //--- Parsing character dependencies line ---
   p1 = ch + 20;  // skip header
   while (*p1) {
@@ -1527,21 +3673,16 @@ void tDeltaSpecs::parse_char_dependencies(const char *ch)
     }
     //--- Reading control character states
     stop = 0;
-    cd.st = 0;
+    cd.st.clear();
     while ((*p1) && (!stop)) {
       n = atoi(p1);
       //cout << "State : " << n << endl;
       if (n > 0)
-        if (n > sizeof(cd.st) * 8)
-          cerr << "Too high state number, not considered"  << endl;
-        else
-          cd.st |= 1 << (n-1);
+        cd.st.push_back(n);
       else {
         cerr << "Error parsing 2 " << get_filename() << endl;
-        delete dc_tmp;
         return;
       }
-      //cout << cd.st << endl;
       while (*p1>='0' && *p1<='9')
         p1++;
       if (*p1=='/')
@@ -1549,17 +3690,17 @@ void tDeltaSpecs::parse_char_dependencies(const char *ch)
       else
         stop = 1;
     }
+    sort(cd.st.begin(), cd.st.end());
+    cd.st.erase(unique(cd.st.begin(), cd.st.end()), cd.st.end());
     if (*p1==':')
       p1++;
     else {
       cerr << "Error parsing 3 " << get_filename() << endl;
-      delete dc_tmp;
       return;
     }
     //--- Reading dependent characters
-    cd.dcnb = 0;
     stop = 0;
-    memset(dc_tmp, '0', char_nb);  // reset dependant character list
+    cd.dc.resize(char_nb);  // reset dependant character list
     while ((*p1) && (!stop)) {
       dc1 = atoi(p1);
       while (*p1>='0' && *p1<='9')
@@ -1573,14 +3714,11 @@ void tDeltaSpecs::parse_char_dependencies(const char *ch)
       else
         dc2 = dc1;
       //cout << "Dependent character(s) : " << dc1 << "-" << dc2 << endl;
-      if ((dc1 > 0) && (dc2 > 0) && (dc2 >= dc1))
-        for (i = dc1; i <= dc2; i++) {
-          dc_tmp[i-1] = '1';
-          cd.dcnb++;
-        }
+      if ((dc1 > 0) && (dc2 >= dc1) && (dc2 <= char_nb))
+        for (i = dc1; i <= dc2; i++)
+          cd.dc.add(i);
       else {
         cerr << "Error parsing 4 " << get_filename() << endl;
-        delete dc_tmp;
         return;
       }
       if (*p1==':')
@@ -1589,11 +3727,614 @@ void tDeltaSpecs::parse_char_dependencies(const char *ch)
         stop = 1;
     }
     //--- Storing character dependencies
-    cd.dc = new char[char_nb+1];
-    strcpy(cd.dc, dc_tmp);   // copy dependent characters in temporary data structure
+    cd.dcnb = cd.dc.count();
     char_dep.push_back(cd);  // stores data in character dependencies list
   }  // while (*p1)
-  delete dc_tmp;
+}
+
+
+//===== tDeltaSnapshot ============================================================
+
+#define SNAPSHOT_MAGIC "TDELTASN"
+
+// Constructors
+tDeltaSnapshot::tDeltaSnapshot(void)
+{
+  hdr = NULL;
+  map_addr = NULL;
+  buf = NULL;
+  size = 0;
+}
+
+tDeltaSnapshot::tDeltaSnapshot(const char *fname)
+{
+  hdr = NULL;
+  map_addr = NULL;
+  buf = NULL;
+  size = 0;
+  open(fname);
+}
+
+// Adds a string to the strings section and returns its position
+// (all empty strings share the position 0)
+static unsigned snapshot_string(string & strings, string_view s)
+{
+  unsigned pos;
+
+  if (s.empty())
+    return 0;
+  pos = strings.size();
+  strings.append(s.data(), s.size());
+  strings += '\0';
+  return pos;
+}
+
+//----- Writes a parsed dataset -----------------------------------------------
+int tDeltaSnapshot::save(tDelta & delta, const char *fname)
+{
+  tHeader h;
+  vector<tChar> char_tab;
+  vector<unsigned> state_tab, attr_order;
+  vector<tItem> item_tab;
+  vector<tAttr> attr_tab;
+  vector<tAlt> alt_tab;
+  vector<double> value_tab;
+  vector<tImplVal> iv_tab;
+  vector<tDep> dep_tab;
+  vector<unsigned> dep_first;
+  vector<int> dep_index;
+  string strings(1, '\0');  // position 0 = empty string
+  const void *sect[S_NB];
+  long long len[S_NB], pos;
+  static const char pad[8] = { 0 };
+  FILE *f;
+  int i, j, k, l, m, n, ok;
+
+  if (!delta.chars || !delta.items || !delta.chars->is_parsed() || !delta.items->is_parsed()) {
+    cerr << "tDeltaSnapshot::save() : dataset not parsed" << endl;
+    return 0;
+  }
+  //--- Characters
+  tDeltaCharList *chars = delta.chars;
+  n = chars->char_list.size();
+  char_tab.resize(n);
+  for (i=0; i<n; i++) {
+    const tDeltaCharList::tCharDescr & cd = chars->char_list[i];
+    char_tab[i].feature = snapshot_string(strings, cd.feature);
+    char_tab[i].unit = snapshot_string(strings, cd.unit);
+    char_tab[i].char_type = cd.char_type;
+    char_tab[i].first_state = state_tab.size();
+    char_tab[i].nbstates = cd.states.size();
+    for (j=0; j<cd.states.size(); j++)
+      state_tab.push_back(snapshot_string(strings, cd.states[j]));
+  }
+  //--- Items, attributes and alternatives
+  tDeltaItemList *items = delta.items;
+  n = items->item_list.size();
+  item_tab.resize(n);
+  for (i=0; i<n; i++) {
+    const tDeltaItemList::tItemDescr & id = items->item_list[i];
+    item_tab[i].name = snapshot_string(strings, id.name);
+    item_tab[i].first_attr = attr_tab.size();
+    item_tab[i].nbattr = id.attributes.size();
+    for (j=0; j<id.attributes.size(); j++) {
+      const tAttrDescr & ad = id.attributes[j];
+      tAttr at;
+      at.charnum = ad.get_charnum();
+      at.comment = snapshot_string(strings, ad.get_charcomment());
+      at.alt = snapshot_string(strings, ad.get_alternatives());
+      at.first_alt = alt_tab.size();
+      at.nbalt = ad.get_alt_nb();
+      for (k=1; k<=at.nbalt; k++) {
+        const tAltDescr & altd = ad.get_alt(k);
+        tAlt al;
+        al.comment = snapshot_string(strings, altd.get_comment());
+        al.first_value = value_tab.size();
+        m = altd.get_values_nb();
+        al.nbvalues = m;
+        al.val_rel = altd.get_val_rel();
+        al.extr_val = altd.get_extr_val();
+        for (l=1; l<=m; l++)
+          value_tab.push_back(altd.get_value(l));
+        alt_tab.push_back(al);
+      }
+      attr_tab.push_back(at);
+      // attributes order (sorted by character number, see tItemDescr::build_index)
+      attr_order.push_back(id.char_index.empty() ? j : id.char_index[j]);
+    }
+  }
+  //--- Specifications
+  memset(&h, 0, sizeof(h));
+  tDeltaSpecs *specs = delta.specs;
+  if (specs && specs->is_parsed() && specs->impl_val) {
+    h.has_specs = 1;
+    n = chars->char_list.size();
+    iv_tab.resize(n);
+    for (i=0; i<n; i++) {
+      iv_tab[i].iv1 = specs->impl_val[i].iv1;
+      iv_tab[i].iv2 = specs->impl_val[i].iv2;
+    }
+    dep_tab.resize(specs->char_dep.size());
+    for (i=0; i<dep_tab.size(); i++) {
+      dep_tab[i].cc = specs->char_dep[i].cc;
+      dep_tab[i].dcnb = specs->char_dep[i].dcnb;
+      string dc(n, '0');
+      const tItemSet & set = specs->char_dep[i].dc;
+      for (j=set.first(); j; j=set.next(j))
+        dc[j-1] = '1';
+      dep_tab[i].dc = snapshot_string(strings, dc);
+    }
+    // lookup table, in the same order as the dependencies
+    dep_first.resize(n+1);
+    for (i=0; i<n; i++) {
+      dep_first[i] = dep_index.size();
+      if (i < specs->dep_index.size())
+        dep_index.insert(dep_index.end(), specs->dep_index[i].begin(),
+                         specs->dep_index[i].end());
+    }
+    dep_first[n] = dep_index.size();
+  }
+  //--- Positions are stored on 32 bits, and counts as int
+  if ((strings.size() >= 0xFFFFFFFFULL) || (value_tab.size() > INT_MAX) ||
+      (alt_tab.size() > INT_MAX) || (attr_tab.size() > INT_MAX) ||
+      (state_tab.size() > INT_MAX)) {
+    cerr << "tDeltaSnapshot::save() : dataset too large" << endl;
+    return 0;
+  }
+  //--- Header
+  memcpy(h.magic, SNAPSHOT_MAGIC, 8);
+  h.version = SNAPSHOT_VERSION;
+  h.byte_order = 0x01020304;
+  sect[S_CHARS] = char_tab.data();       h.count[S_CHARS] = char_tab.size();
+  sect[S_STATES] = state_tab.data();     h.count[S_STATES] = state_tab.size();
+  sect[S_ITEMS] = item_tab.data();       h.count[S_ITEMS] = item_tab.size();
+  sect[S_ATTRS] = attr_tab.data();       h.count[S_ATTRS] = attr_tab.size();
+  sect[S_ATTR_ORDER] = attr_order.data();  h.count[S_ATTR_ORDER] = attr_order.size();
+  sect[S_ALTS] = alt_tab.data();         h.count[S_ALTS] = alt_tab.size();
+  sect[S_VALUES] = value_tab.data();     h.count[S_VALUES] = value_tab.size();
+  sect[S_IMPL_VAL] = iv_tab.data();      h.count[S_IMPL_VAL] = iv_tab.size();
+  sect[S_DEPS] = dep_tab.data();         h.count[S_DEPS] = dep_tab.size();
+  sect[S_DEP_FIRST] = dep_first.data();  h.count[S_DEP_FIRST] = dep_first.size();
+  sect[S_DEP_INDEX] = dep_index.data();  h.count[S_DEP_INDEX] = dep_index.size();
+  sect[S_STRINGS] = strings.data();      h.count[S_STRINGS] = strings.size();
+  pos = (sizeof(tHeader) + 7) & ~7LL;
+  for (i=0; i<S_NB; i++) {
+    len[i] = (long long) h.count[i] * record_size(i);
+    h.offset[i] = pos;
+    pos += (len[i] + 7) & ~7LL;
+  }
+  //--- Writing
+  f = fopen(fname, "wb");
+  if (!f) {
+    cerr << "Unable to create " << fname << endl;
+    return 0;
+  }
+  ok = (fwrite(&h, sizeof(h), 1, f) == 1);
+  pos = sizeof(h);
+  for (i=0; (i<S_NB) && ok; i++) {
+    if (h.offset[i] > pos)
+      ok = (fwrite(pad, h.offset[i] - pos, 1, f) == 1);
+    if (ok && len[i])
+      ok = (fwrite(sect[i], len[i], 1, f) == 1);
+    pos = h.offset[i] + len[i];
+  }
+  if (fclose(f) || !ok) {
+    cerr << "Error writing " << fname << endl;
+    return 0;
+  }
+  return 1;
+}
+
+//----- Size of the records of a section ---------------------------------------
+int tDeltaSnapshot::record_size(int section)
+{
+  switch (section) {
+    case S_CHARS :      return sizeof(tChar);
+    case S_STATES :     return sizeof(unsigned);
+    case S_ITEMS :      return sizeof(tItem);
+    case S_ATTRS :      return sizeof(tAttr);
+    case S_ATTR_ORDER : return sizeof(unsigned);
+    case S_ALTS :       return sizeof(tAlt);
+    case S_VALUES :     return sizeof(double);
+    case S_IMPL_VAL :   return sizeof(tImplVal);
+    case S_DEPS :       return sizeof(tDep);
+    case S_DEP_FIRST :  return sizeof(unsigned);
+    case S_DEP_INDEX :  return sizeof(int);
+    default :           return 1;  // strings
+  }
+}
+
+//----- Loads a snapshot ------------------------------------------------------
+int tDeltaSnapshot::open(const char *fname)
+{
+  FILE *f;
+
+  close();
+#ifdef TDELTA_MMAP
+  struct stat st;
+  int fd;
+  void *addr;
+
+  fd = ::open(fname, O_RDONLY);
+  if (fd >= 0) {
+    if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0)) {
+      addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED) {
+        map_addr = addr;
+        size = st.st_size;
+      }
+    }
+    ::close(fd);
+  }
+#endif
+  if (!map_addr) {
+    //--- Not mapped : reading the whole file
+    f = fopen(fname, "rb");
+    if (!f) {
+      cerr << "Unable to open " << fname << endl;
+      return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = (char *) malloc(size > 0 ? size : 1);
+    if ((size <= 0) || (fread(buf, size, 1, f) != 1)) {
+      fclose(f);
+      cerr << "Error reading " << fname << endl;
+      close();
+      return 0;
+    }
+    fclose(f);
+  }
+  if (!check()) {
+    cerr << fname << " is not a valid tDelta snapshot (version "
+         << SNAPSHOT_VERSION << ")" << endl;
+    close();
+    return 0;
+  }
+  return 1;
+}
+
+//----- Unloads the snapshot --------------------------------------------------
+void tDeltaSnapshot::close(void)
+{
+#ifdef TDELTA_MMAP
+  if (map_addr)
+    munmap(map_addr, size);
+#endif
+  free(buf);
+  map_addr = NULL;
+  buf = NULL;
+  size = 0;
+  hdr = NULL;
+}
+
+//----- Checks the snapshot and sets the sections pointers --------------------
+//        Each position stored in the file is checked once, so that the
+//        accessors don't need to check them
+int tDeltaSnapshot::check(void)
+{
+  const char *data;
+  const tHeader *h;
+  long long end;
+  unsigned nbstr;
+  int i, j, n;
+
+  data = map_addr ? (const char *) map_addr : buf;
+  if (size < sizeof(tHeader))
+    return 0;
+  h = (const tHeader *) data;
+  if (memcmp(h->magic, SNAPSHOT_MAGIC, 8) || (h->version != SNAPSHOT_VERSION) ||
+      (h->byte_order != 0x01020304))
+    return 0;
+  for (i=0; i<S_NB; i++) {
+    if ((h->offset[i] < sizeof(tHeader)) || (h->offset[i] & 7) || (h->count[i] < 0))
+      return 0;
+    end = h->offset[i] + (long long) h->count[i] * record_size(i);
+    if (end > size)
+      return 0;
+  }
+  char_tab = (const tChar *) (data + h->offset[S_CHARS]);
+  state_tab = (const unsigned *) (data + h->offset[S_STATES]);
+  item_tab = (const tItem *) (data + h->offset[S_ITEMS]);
+  attr_tab = (const tAttr *) (data + h->offset[S_ATTRS]);
+  attr_order = (const unsigned *) (data + h->offset[S_ATTR_ORDER]);
+  alt_tab = (const tAlt *) (data + h->offset[S_ALTS]);
+  value_tab = (const double *) (data + h->offset[S_VALUES]);
+  iv_tab = (const tImplVal *) (data + h->offset[S_IMPL_VAL]);
+  dep_tab = (const tDep *) (data + h->offset[S_DEPS]);
+  dep_first = (const unsigned *) (data + h->offset[S_DEP_FIRST]);
+  dep_index = (const int *) (data + h->offset[S_DEP_INDEX]);
+  strings = data + h->offset[S_STRINGS];
+  //--- Strings section ends with a null character
+  nbstr = h->count[S_STRINGS];
+  if (!nbstr || strings[nbstr-1])
+    return 0;
+  //--- Characters
+  for (i=0; i<h->count[S_CHARS]; i++) {
+    const tChar & c = char_tab[i];
+    if ((c.feature >= nbstr) || (c.unit >= nbstr) || (c.nbstates < 0) ||
+        ((long long) c.first_state + c.nbstates > h->count[S_STATES]))
+      return 0;
+  }
+  for (i=0; i<h->count[S_STATES]; i++)
+    if (state_tab[i] >= nbstr)
+      return 0;
+  //--- Items
+  if (h->count[S_ATTR_ORDER] != h->count[S_ATTRS])
+    return 0;
+  for (i=0; i<h->count[S_ITEMS]; i++) {
+    const tItem & it = item_tab[i];
+    if ((it.name >= nbstr) || (it.nbattr < 0) ||
+        ((long long) it.first_attr + it.nbattr > h->count[S_ATTRS]))
+      return 0;
+    for (j=0; j<it.nbattr; j++)
+      if (attr_order[it.first_attr + j] >= it.nbattr)
+        return 0;
+  }
+  for (i=0; i<h->count[S_ATTRS]; i++) {
+    const tAttr & at = attr_tab[i];
+    if ((at.comment >= nbstr) || (at.alt >= nbstr) || (at.nbalt < 0) ||
+        ((long long) at.first_alt + at.nbalt > h->count[S_ALTS]))
+      return 0;
+  }
+  for (i=0; i<h->count[S_ALTS]; i++) {
+    const tAlt & al = alt_tab[i];
+    n = al.nbvalues;
+    if (al.val_rel == '-')  // extreme values are skipped by compare_values()
+      n -= ((al.extr_val & EXTRVAL_LOW) != 0) + ((al.extr_val & EXTRVAL_HIGH) != 0) + 1;
+    if ((al.comment >= nbstr) || (n < 0) ||
+        ((long long) al.first_value + al.nbvalues > h->count[S_VALUES]))
+      return 0;
+  }
+  //--- Specifications
+  if (h->count[S_IMPL_VAL] && (h->count[S_IMPL_VAL] != h->count[S_CHARS]))
+    return 0;
+  for (i=0; i<h->count[S_DEPS]; i++)
+    if ((dep_tab[i].dc >= nbstr) ||
+        (strlen(strings + dep_tab[i].dc) < h->count[S_CHARS]))
+      return 0;
+  if (h->count[S_DEP_FIRST]) {
+    if ((h->count[S_DEP_FIRST] != h->count[S_CHARS] + 1) || dep_first[0] ||
+        (dep_first[h->count[S_CHARS]] != h->count[S_DEP_INDEX]))
+      return 0;
+    for (i=0; i<h->count[S_CHARS]; i++)
+      if (dep_first[i] > dep_first[i+1])
+        return 0;
+    for (i=0; i<h->count[S_DEP_INDEX]; i++)
+      if ((dep_index[i] < 0) || (dep_index[i] > h->count[S_DEPS]))
+        return 0;
+  }
+  else if (h->count[S_DEPS] || h->count[S_DEP_INDEX])
+    return 0;
+  hdr = h;
+  return 1;
+}
+
+//----- Characters ------------------------------------------------------------
+int tDeltaSnapshot::get_chars_nb(void) const
+{
+  return hdr ? hdr->count[S_CHARS] : 0;
+}
+
+int tDeltaSnapshot::get_char_type(int charnum) const
+{
+  if ((charnum < 1) || (charnum > get_chars_nb()))
+    return 0;
+  return char_tab[charnum-1].char_type;
+}
+
+const char *tDeltaSnapshot::get_char_feature(int charnum) const
+{
+  if ((charnum < 1) || (charnum > get_chars_nb()))
+    return "";
+  return strings + char_tab[charnum-1].feature;
+}
+
+const char *tDeltaSnapshot::get_char_unit(int charnum) const
+{
+  if ((charnum < 1) || (charnum > get_chars_nb()))
+    return "";
+  if (char_tab[charnum-1].char_type & CT_IN)   // numeric character
+    return strings + char_tab[charnum-1].unit;
+  return "";
+}
+
+int tDeltaSnapshot::get_states_nb(int charnum) const
+{
+  if ((charnum < 1) || (charnum > get_chars_nb()))
+    return 0;
+  if (char_tab[charnum-1].char_type & CT_UM)   // multistate character
+    return char_tab[charnum-1].nbstates;
+  return 0;
+}
+
+const char *tDeltaSnapshot::get_state(int charnum, int statenum) const
+{
+  if ((statenum < 1) || (statenum > get_states_nb(charnum)))
+    return "";
+  return strings + state_tab[char_tab[charnum-1].first_state + statenum-1];
+}
+
+//----- Items -----------------------------------------------------------------
+int tDeltaSnapshot::get_items_nb(void) const
+{
+  return hdr ? hdr->count[S_ITEMS] : 0;
+}
+
+const char *tDeltaSnapshot::get_item_name(int itemnum) const
+{
+  if ((itemnum < 1) || (itemnum > get_items_nb()))
+    return "";
+  return strings + item_tab[itemnum-1].name;
+}
+
+string tDeltaSnapshot::get_item_name(int itemnum, int comment) const
+{
+  const char *name;
+  string str;
+
+  name = get_item_name(itemnum);
+  if (comment)
+    return name;
+  str.resize(strlen(name)+1);
+  remove_comments(name, &str[0]);
+  str.resize(strlen(str.c_str()));
+  return str;
+}
+
+int tDeltaSnapshot::get_attributes_nb(int itemnum) const
+{
+  if ((itemnum < 1) || (itemnum > get_items_nb()))
+    return 0;
+  return item_tab[itemnum-1].nbattr;
+}
+
+string tDeltaSnapshot::get_attribute(int itemnum, int attrnum) const
+{
+  char ch[16];
+
+  if ((itemnum < 1) || (itemnum > get_items_nb())) {
+    cerr << "Invalid item number" << endl;
+    return "";
+  }
+  if ((attrnum < 1) || (attrnum > item_tab[itemnum-1].nbattr)) {
+    cerr << "Invalid attribute number" << endl;
+    return "";
+  }
+  const tAttr & at = attr_tab[item_tab[itemnum-1].first_attr + attrnum-1];
+  sprintf(ch, "%d", at.charnum);
+  return ch + string(strings + at.comment) + "," + (strings + at.alt);
+}
+
+//----- Position of a character in the attributes of an item (-1 if not found)
+int tDeltaSnapshot::find_attribute(const tItem & it, int charnum) const
+{
+  const unsigned *order;
+  int lo, hi, mid;
+
+  order = attr_order + it.first_attr;
+  lo = 0;
+  hi = it.nbattr;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (attr_tab[it.first_attr + order[mid]].charnum < charnum)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if ((lo < it.nbattr) && (attr_tab[it.first_attr + order[lo]].charnum == charnum))
+    return it.first_attr + order[lo];
+  return -1;
+}
+
+//----- Test if a given item is matching with values (see tDeltaItemList) -----
+int tDeltaSnapshot::matches(int itemnum, int charnum, const double *values, int nbval,
+                            int strict, int with_extrval) const
+{
+  int i, a;
+
+  if ((itemnum < 1) || (itemnum > get_items_nb())) {
+    cerr << "Invalid item number" << endl;
+    return 0;
+  }
+  a = find_attribute(item_tab[itemnum-1], charnum);
+  if (a < 0)
+    return strict ? 0 : 1;  // character not found : UNKNOWN value
+  const tAttr & at = attr_tab[a];
+  for (i=0; i<at.nbalt; i++) {
+    const tAlt & al = alt_tab[at.first_alt + i];
+    if (tAltDescr::compare_values(value_tab + al.first_value, al.nbvalues, al.val_rel,
+                                  al.extr_val, values, nbval, strict, with_extrval))
+      return 1;
+  }
+  return 0;
+}
+
+//----- Specifications --------------------------------------------------------
+int tDeltaSnapshot::has_specs(void) const
+{
+  return hdr ? hdr->has_specs : 0;
+}
+
+int tDeltaSnapshot::get_implicit_value(int charnum, int iv_type) const
+{
+  if (!has_specs())
+    return 0;
+  if ((charnum < 1) || (charnum > get_chars_nb())) {
+    cerr << "tDeltaSnapshot::get_implicit_value() : charnum parameter out of range" << endl;
+    return 0;
+  }
+  switch (iv_type) {
+    case 1 :
+      return iv_tab[charnum-1].iv1;
+    case 2 :
+      return iv_tab[charnum-1].iv2;
+    default :
+      cerr << "tDeltaSnapshot::get_implicit_value() : erroneous iv_type parameter" << endl;
+      return 0;
+  }
+}
+
+//----- Dependency of a control character and state (NULL if none) -----------
+const tDeltaSnapshot::tDep *tDeltaSnapshot::find_dep(int ccnum, int ccstate) const
+{
+  unsigned first;
+  int i;
+
+  if ((ccnum < 1) || (ccnum > get_chars_nb())) {
+    cerr << "tDeltaSnapshot : ccnum parameter out of range" << endl;
+    return NULL;
+  }
+  if (ccstate < 1) {
+    cerr << "tDeltaSnapshot : ccstate parameter out of range" << endl;
+    return NULL;
+  }
+  if (!hdr->count[S_DEP_FIRST])
+    return NULL;
+  first = dep_first[ccnum-1];
+  if (ccstate > dep_first[ccnum] - first)
+    return NULL;
+  i = dep_index[first + ccstate-1];
+  return i ? dep_tab + i-1 : NULL;
+}
+
+int tDeltaSnapshot::get_depchar_nb(int ccnum, int ccstate) const
+{
+  const tDep *d;
+
+  d = find_dep(ccnum, ccstate);
+  return d ? d->dcnb : 0;
+}
+
+int tDeltaSnapshot::get_depchar(int ccnum, int ccstate, int rank) const
+{
+  const tDep *d;
+  const char *dc;
+  int j, n, m;
+
+  d = find_dep(ccnum, ccstate);
+  if (!d || (rank < 1) || (rank > d->dcnb))
+    return 0;
+  dc = strings + d->dc;
+  m = get_chars_nb();
+  n = 0;
+  for (j=0; j<m; j++)
+    if ((dc[j] == '1') && (++n == rank))
+      return (j+1);
+  return 0;
+}
+
+int tDeltaSnapshot::is_dependent(int dcnum, int ccnum, int ccstate) const
+{
+  const tDep *d;
+
+  if ((dcnum < 1) || (dcnum > get_chars_nb())) {
+    cerr << "tDeltaSnapshot::is_dependent() : dcnum parameter out of range" << endl;
+    return 0;
+  }
+  d = find_dep(ccnum, ccstate);
+  return d ? (strings[d->dc + dcnum-1] == '1') : 0;
 }
 
 
@@ -1603,21 +4344,27 @@ void tDeltaSpecs::parse_char_dependencies(const char *ch)
 //         Comments are delimited with brackets <>; nested comments are allowed.
 void remove_comments(const char *src, char *dest)
 {
-  const char *p1;
+  const char *p1, *p3, *end;
   char *p2;
   int comment=0;
 
   p1 = src;
   p2 = dest;
-  while (*p1) {
+  end = src + strlen(src);
+  while (p1 < end) {
+    // Text up to the next bracket is copied if outside comments
+    p3 = scan_bytes(p1, end, '<', '>', '>');
+    if (!comment) {
+      memcpy(p2, p1, p3 - p1);
+      p2 += p3 - p1;
+    }
+    p1 = p3;
+    if (p1 == end)
+      break;
     if (*p1 == '<')     // comment begin
       comment++;
-    else
-      if (*p1 == '>')   // comment end
-        comment--;
-      else
-        if (!comment)
-          *p2++ = *p1;
+    else                // comment end
+      comment--;
     p1++;
   }
   *p2 = '\x00';
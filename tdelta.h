@@ -23,11 +23,15 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <memory_resource>
+#include <atomic>
 #include "tfile.h"
 
 using namespace std;
 
-#define BUFSIZE 4096
+//----- Library version (part of the parse cache keys)
+#define TDELTA_VERSION "0.20.2"
 
 //----- Character types
 #define CT_UM 2  // unordered multistate (default multistate)
@@ -40,6 +44,16 @@ using namespace std;
 #define EXTRVAL_LOW  1  // extreme low value
 #define EXTRVAL_HIGH 2  // extreme high value
 
+//---- Parsing options (tDelta constructors 'parse' argument)
+#define PARSE_NOW      1  // immediate parsing
+#define PARSE_PARALLEL 2  // items file parsed by several threads
+#define PARSE_CONCURRENT 4  // characters and items files parsed concurrently
+#define PARSE_INDEX    8  // identification indexes built after parsing
+#define PARSE_MATRIX  16  // item x character matrix built after parsing
+#define PARSE_ARENA   32  // item descriptions allocated in arenas
+#define PARSE_LAZY    64  // alternatives values decoded on first use
+#define PARSE_STREAM 128  // items not parsed (read by tDelta::stream_items)
+
 //---- Special character values
 #define VARIABLE -999999
 #define UNKNOWN  -999998
@@ -48,17 +62,116 @@ using namespace std;
 
 //----- DeltaFile class (items or chars files) -----------------------------------
 //        Derived from the generic tTextFile class
+//        In read access mode, regular files are memory-mapped when the system
+//        allows it and lines are returned as spans into the mapping (no copy,
+//        no line length limit). Other files (pipes, ...) are read through a
+//        growable line buffer.
+//        A tDeltaFile can also read a memory block (part of a mapped file).
 class tDeltaFile : public tTextFile {
   public :
-    tDeltaFile(const char * _name) : tTextFile(_name)  { lines_nb = 0; }
+    tDeltaFile(const char * _name);
+    tDeltaFile(const char * _name, const char *begin, const char *end);
+      // reading of the memory block [begin, end[ (_name is used for messages)
+    ~tDeltaFile(void)  { close(); }
+    virtual int open(const unsigned access_mode);
+    int close(void);
     // Reads the next line from the file, with skipping empty lines and
     // deleting blank and tab characters at the begin of the line
     int next_line(char *dest, const int lmax = LMAXLINE);
+    // Same as above, without copy : the line is given as a span [line, eol[
+    // which remains valid until the next reading (or until closing the file)
+    int next_line(const char * & line, const char * & eol);
     int get_lines_nb(void)  { return lines_nb; }
+    int eof(void);
+    // Memory mapping (on by default; must be set before opening the file)
+    void set_mapping(int on)  { use_map = on; }
+    int is_mapped(void)  { return in_memory; }
+    // Release of the mapping pages already read (off by default), so that
+    // a large file read once keeps few pages in memory. Spans of the
+    // previous lines may not be used any more.
+    void set_release(int on)  { release = on; }
+    // Mapped data (or memory block)
+    const char *get_data(void)  { return map_begin; }
+    const char *get_data_end(void)  { return map_end; }
   protected :
     int lines_nb;  // number of lines
+    int use_map;   // memory mapping allowed
+    int in_memory; // reading from the mapping (or from a memory block)
+    int release;   // release of the pages already read
+    void *map_addr;       // mapping address (NULL=not mapped)
+    long map_size;        // mapping size
+    const char *map_begin;  // begin of the mapping
+    const char *map_pos;    // reading position in the mapping
+    const char *map_end;    // end of the mapping
+    const char *map_released;  // pages released up to this position
+    string lbuf;          // line buffer (not mapped files)
 };
 
+//----- Parse cache ----------------------------------------------------------------
+//        Parsed forms of the Delta files are stored in a cache directory, under
+//        a key computed from the file contents, the kind of file and the
+//        library version : a file is parsed again only if it has changed.
+//        PARSE_CACHE_VERSION must be increased when a parsed form changes.
+#define PARSE_CACHE_VERSION 2
+
+class tParseCache {
+  public :
+    tParseCache(void)  { pos = end = NULL;  bad = 1; }
+    // Key of a file (0 if the file can't be mapped, e.g. a pipe)
+    //    kind = "chars", "items" or "specs"
+    static unsigned long long file_key(const char *fname, const char *kind);
+    // Hash of a memory block (FNV-1a), chained with a previous hash
+    static unsigned long long hash(const char *data, long size,
+                                   unsigned long long h=14695981039346656037ULL);
+    //--- Writing : values are buffered, then stored under a key
+    //    return value : 1=ok 0=error
+    void put_int(int n);
+    void put_double(double x);
+    void put_string(const string & s);
+    void put_string(const pmr::string & s);
+    int store(const string & dir, unsigned long long key);
+    //--- Reading : the entry is loaded, then values are read in the same
+    //    order as they were written
+    //    return value : 1=ok 0=no entry
+    int load(const string & dir, unsigned long long key);
+    int get_int(void);
+    double get_double(void);
+    void get_string(string & s);
+    void get_string(pmr::string & s);
+    // Number of elements of a list (-1 if not consistent with the entry size)
+    int get_count(void);
+    // All values read, without reading beyond the end of the entry
+    int is_complete(void)  { return !bad && (pos == end); }
+  protected :
+    string data;
+    const char *pos, *end;  // reading position and end of the entry
+    int bad;  // no entry loaded, or reading beyond its end
+    string entry_name(const string & dir, unsigned long long key);
+};
+
+//----- Directive table --------------------------------------------------------
+//        Directives of a Delta file ('*' lines), keyed by their name in upper
+//        case ("SHOW", "NUMBER OF CHARACTERS", ...). The value is the text
+//        following the name, without its first blank.
+//        Known names are recognized as the longest matching one (case is
+//        ignored); an unknown directive is keyed by its first word.
+//        When a directive appears several times, its first value is kept.
+class tDirectiveTable {
+  public :
+    tDirectiveTable(void)  { }
+    void clear(void)  { table.clear(); }
+    // Adds a directive ('*' optional)
+    //    return value : name of the directive
+    const string & add(const char *line, const char *eol);
+    void add(const vector<string> & lines);
+    //--- Lookup (name in upper case)
+    int has(const char *name) const  { return table.count(name) != 0; }
+    string get(const char *name) const;  // "" if absent
+    int get_int(const char *name) const;  // 0 if absent or not a count
+    int size(void) const  { return table.size(); }
+  protected :
+    map<string, string> table;
+};
 
 //----- Delta character list class -----------------------------------------------
 class tDeltaCharList {
@@ -75,6 +188,13 @@ class tDeltaCharList {
     int parse_characters(void);
     // Set or change the character list file
     void set_filename(const char *fname, int parse=1);
+    // Declared sizes (see tDeltaSpecs::get_declared_states), used to pre-size
+    // the lists when they are plausible for the file size
+    //    nbstates[charnum-1] = number of states (0=not declared)
+    void set_declared_sizes(int _nbchars, const vector<int> & nbstates)
+      { decl_chars = _nbchars;  decl_states = nbstates; }
+    // Parse cache directory (empty = no cache; see tParseCache)
+    void set_cache(const char *dir)  { cache_dir = dir ? dir : ""; }
     //--- Member functions returning character list information
     const char * get_filename(void);
     int is_parsed(void)  { return parsed; }
@@ -85,9 +205,15 @@ class tDeltaCharList {
     string get_char_unit(int charnum);
     int get_states_nb(int charnum);
     string get_state(int charnum, int statenum);
+    // Directives of the file (see tDirectiveTable)
+    const tDirectiveTable & get_directives(void) const  { return dir_table; }
+    // Removes excluded characters and renumbers the remaining ones
+    //    charmap[old number] = new number (0=excluded)
+    void renumber_characters(const vector<int> &charmap);
     // For debuging
     void retrieve_all(void);
   protected :
+    friend class tDeltaSnapshot;
     tDeltaFile *fchars;
     //----- Delta character description class
     class tCharDescr {
@@ -100,12 +226,19 @@ class tDeltaCharList {
     };
     vector<tCharDescr> char_list;
     tCharDescr cd;
+    string sbuf;  // scratch buffer (reused from one character or state to the next)
     vector<string> directives;
+    tDirectiveTable dir_table;
+    string cache_dir;
     int parsed;   // file parsing flag
     int nbchars;  // number of characters
-    int read_directive(char *cline, char * & p1);
-    int read_character(char *cline, char * & p1);
-    int read_state(char *cline, char * & p1, int & nbstates);
+    int decl_chars;           // declared sizes (see set_declared_sizes)
+    vector<int> decl_states;
+    void save_cache(tParseCache & cache);
+    int load_cache(tParseCache & cache);
+    int read_directive(const char * & p1, const char * & eol);
+    int read_character(const char * & p1, const char * & eol);
+    int read_state(const char * & p1, const char * & eol, int & nbstates);
 };
 
 
@@ -119,55 +252,249 @@ class tDeltaCharList {
 //   values list.
 // - Values list are described in tValList class, which declaration is included
 //   in tAltDescr class.
+// - Item descriptions, attributes and alternatives take an allocator (memory
+//   resource) which is propagated to all their strings and vectors, so that an
+//   item list can be allocated in an arena (see tDeltaItemList::set_arena).
+//   Copies keep the allocator of the copied object.
 // See Delta format documentation and tDelta diagram for more information.
 
 //--- Alternative description class ---------------------------------
 class tAltDescr {
   public :
+    typedef pmr::polymorphic_allocator<char> allocator_type;
     tAltDescr(void)  { }
-    int parse_alternative(char *altstr);
-    void set_comment(char *str) { comment = str; }
-    string get_comment(void)  { return comment; }
+    explicit tAltDescr(const allocator_type & a) : value_list(a), comment(a)  { }
+    tAltDescr(const tAltDescr & ad) : tAltDescr(ad, ad.get_allocator())  { }
+    tAltDescr(const tAltDescr & ad, const allocator_type & a)
+      : value_list(ad.value_list, a), comment(ad.comment, a)  { }
+    tAltDescr(tAltDescr && ad) = default;
+    tAltDescr(tAltDescr && ad, const allocator_type & a)
+      : value_list(std::move(ad.value_list), a), comment(std::move(ad.comment), a)  { }
+    tAltDescr & operator = (const tAltDescr & ad) = default;
+    tAltDescr & operator = (tAltDescr && ad) = default;
+    allocator_type get_allocator(void) const  { return comment.get_allocator(); }
+    int parse_alternative(const char *altstr);
+    // Same parsing of the span [altstr, end[ ; the position where the parsing
+    // stopped is returned in stop (if not NULL)
+    int parse_alternative(const char *altstr, const char *end, const char **stop=NULL);
+    void set_comment(const char *str) { comment = str; }
+    string get_comment(void) const  { return string(comment); }
+    // Values list information (rank = 1 to get_values_nb())
+    int get_values_nb(void) const  { return value_list.values.size(); }
+    double get_value(int rank) const  { return value_list.values[rank-1]; }
+    char get_val_rel(void) const  { return value_list.val_rel; }
+    int get_extr_val(void) const  { return value_list.extr_val; }
     // Comparison between alternative values and given value(s)
-    int compare(double *values, int nbval=1, int strict=1, int with_extrval=1);
+    int compare(const double *values, int nbval=1, int strict=1,
+                int with_extrval=1) const;
       // values : pointer of a value or values table
       // nbval  : number of elements in values
       // strict (boolean) : strict comparison (comparison with UNKNOWN gives false)
       // with_extrval (boolean) : comparison with values including extreme values
+    // Storing in (and loading from) the parse cache
+    void save_cache(tParseCache & cache) const;
+    int load_cache(tParseCache & cache);
+    // Same comparison with an alternative given by its values list
+    static int compare_values(const double *alt_values, int alt_nb, char val_rel,
+                              int extr_val, const double *values, int nbval,
+                              int strict, int with_extrval);
   protected :
     // Values list class
     class tValList {
       public :
         tValList(void)  { }
-        vector<double> values;
+        explicit tValList(const allocator_type & a) : values(a)  { }
+        tValList(const tValList & vl, const allocator_type & a)
+          : values(vl.values, a), val_rel(vl.val_rel), extr_val(vl.extr_val)  { }
+        tValList(tValList && vl, const allocator_type & a)
+          : values(std::move(vl.values), a), val_rel(vl.val_rel), extr_val(vl.extr_val)  { }
+        pmr::vector<double> values;
         char val_rel;  //values relation (0=unique value; '&'=and; '-'=to)
         int extr_val;  //extreme values (0=not; see #define EXTRVAL_...)
     };
     tValList value_list;
-    string comment;    // optional comment
+    pmr::string comment;    // optional comment
 };
 
 //--- Item attribute description class ------------------------------
+//      With a lazy parsing (see parse_attr), only the character number, the
+//      comment and the alternative list text are extracted; the alternatives
+//      are decoded from the text at their first use (get_alt_nb, get_alt,
+//      compare,...). The decoded alternatives are stored once, under a lock,
+//      so that const member functions may be called by several threads.
 class tAttrDescr {
   public :
-    tAttrDescr(void)  { }
-    int parse_attr(char *attr);
+    typedef pmr::polymorphic_allocator<char> allocator_type;
+    tAttrDescr(void) : pending(0)  { }
+    explicit tAttrDescr(const allocator_type & a)
+      : pending(0), comment(a), alternatives(a), alt(a)  { }
+    tAttrDescr(const tAttrDescr & ad) : tAttrDescr(ad, ad.get_allocator())  { }
+    tAttrDescr(const tAttrDescr & ad, const allocator_type & a)
+      : charnum(ad.charnum), pending(ad.pending.load()), comment(ad.comment, a),
+        alternatives(ad.alternatives, a), alt(ad.alt, a)  { }
+    tAttrDescr(tAttrDescr && ad) noexcept
+      : charnum(ad.charnum), pending(ad.pending.load()), comment(std::move(ad.comment)),
+        alternatives(std::move(ad.alternatives)), alt(std::move(ad.alt))  { }
+    tAttrDescr(tAttrDescr && ad, const allocator_type & a)
+      : charnum(ad.charnum), pending(ad.pending.load()), comment(std::move(ad.comment), a),
+        alternatives(std::move(ad.alternatives), a), alt(std::move(ad.alt), a)  { }
+    tAttrDescr & operator = (const tAttrDescr & ad);
+    tAttrDescr & operator = (tAttrDescr && ad);
+    allocator_type get_allocator(void) const  { return comment.get_allocator(); }
+    int parse_attr(const char *attr);
+    int parse_attr(const char *attr, string & buf, int lazy=0);
+      // buf = scratch buffer, which may be reused from one attribute to the next
+      // lazy (boolean) : alternatives decoded at their first use
     // Member functions returning attribute information
-    int get_charnum(void)  { return charnum; }
-    string get_charcomment(void)  { return comment; }
-    string get_alternatives(void) { return alt; }
-    int get_alt_nb(void)  { return alternatives.size(); }
+    int get_charnum(void) const  { return charnum; }
+    void set_charnum(int n)  { charnum = n; }
+    string get_charcomment(void) const  { return string(comment); }
+    string get_alternatives(void) const  { return string(alt); }
+    int get_alt_nb(void) const  { decode();  return alternatives.size(); }
+    tAltDescr & get_alt(int altnum)  { decode();  return alternatives[altnum-1]; }
+    const tAltDescr & get_alt(int altnum) const  { decode();  return alternatives[altnum-1]; }
+    int is_decoded(void) const  { return !pending.load(memory_order_acquire); }
     // Browses alternatives list and makes value(s) comparison
-    int compare(double *values, int nbval=1, int strict=1, int with_extrval=1);
+    int compare(const double *values, int nbval=1, int strict=1,
+                int with_extrval=1) const;
+    // Storing in (and loading from) the parse cache
+    void save_cache(tParseCache & cache) const;
+    int load_cache(tParseCache & cache);
   protected :
     int charnum;                     // character number
-    string comment;                  // optional comment (or value for text characters)
-    vector<tAltDescr> alternatives;  // alternatives list
-    string alt;                      // alternative list (not parsed)
-    int extract_comment(char * & src, char *dest, int lmax);
+    mutable atomic<int> pending;     // alternatives not decoded yet (lazy parsing)
+    pmr::string comment;             // optional comment (or value for text characters)
+    mutable pmr::vector<tAltDescr> alternatives;  // alternatives list
+    pmr::string alt;                 // alternative list (not parsed)
+    int extract_comment(const char * & src, string & dest) const;
       // Extracts comments from src string
+    int parse_alternatives(const char *p1, string & buf, pmr::vector<tAltDescr> & list) const;
+      // Decodes the alternatives from the alternative list (added to list)
+    void decode(void) const  { if (pending.load(memory_order_acquire)) decode_pending(); }
+    void decode_pending(void) const;
+};
+
+//--- Set of items --------------------------------------------------
+//      Stored as a bitset (one bit per item); items are given by their
+//      number (1 to size)
+class tItemSet {
+  public :
+    tItemSet(void)  { nb = 0; }
+    tItemSet(int n, int full=0)  { nb = 0;  resize(n, full); }
+    // Sets the number of items; the set is emptied (full=0) or filled (full=1)
+    void resize(int n, int full=0);
+    int size(void) const  { return nb; }
+    void add(int itemnum)  { bits[(itemnum-1) >> 6] |= (1ULL << ((itemnum-1) & 63)); }
+    void remove(int itemnum)  { bits[(itemnum-1) >> 6] &= ~(1ULL << ((itemnum-1) & 63)); }
+    int contains(int itemnum) const
+      { return (bits[(itemnum-1) >> 6] >> ((itemnum-1) & 63)) & 1; }
+    void clear(void);            // removes all items
+    void fill(void);             // adds all items
+    int count(void) const;       // number of items in the set
+    int empty(void) const;
+    // Browsing the set : returns item number, or 0 at end of set
+    int first(void) const  { return next(0); }
+    int next(int itemnum) const;
+    // Intersection, union and difference with another set (of the same size)
+    tItemSet & operator &= (const tItemSet & s);
+    tItemSet & operator |= (const tItemSet & s);
+    tItemSet & operator -= (const tItemSet & s);
+    int operator == (const tItemSet & s) const  { return (nb == s.nb) && (bits == s.bits); }
+  protected :
+    vector<unsigned long long> bits;
+    int nb;  // number of items
+};
+
+//--- Interval index ------------------------------------------------
+//      Closed intervals [lo, hi] associated with items, searched by value.
+//      Intervals are sorted by lower bound and stored as an implicit binary
+//      tree in which each node keeps the highest upper bound of its subtree,
+//      so a search costs O(log n + number of intervals found).
+class tIntervalIndex {
+  public :
+    tIntervalIndex(void)  { root_level = -1; }
+    void add(double lo, double hi, int itemnum);
+    void build(void);  // to be called once all intervals are added
+    void clear(void)  { intervals.clear();  root_level = -1; }
+    int size(void) const  { return intervals.size(); }
+    // Adds to result the items of the intervals containing value
+    // (the index must have been built)
+    void search(double value, tItemSet & result) const;
+  protected :
+    struct tInterval {
+      double lo, hi;
+      double max;   // highest upper bound of the subtree
+      int itemnum;
+      bool operator < (const tInterval & iv) const  { return lo < iv.lo; }
+    };
+    vector<tInterval> intervals;
+    int root_level;  // level of the tree root (-1=empty)
+};
+
+//--- Item x character matrix --------------------------------------
+//      Columnar copy of the parsed attributes : for each character, the
+//      alternatives of all the items are stored in a few contiguous arrays,
+//      so that a character is scanned for all the items without following
+//      pointers from one item (or alternative) to the other.
+class tItemMatrix {
+  public :
+    //--- Column of a character
+    class tColumn {
+      public :
+        tColumn(void)  { }
+        vector<unsigned> cells;  // item i : alternatives cells[i-1] to cells[i]-1
+        vector<unsigned> alts;   // alternative k : values alts[k] to alts[k+1]-1
+        vector<char> val_rel;    // values relation of each alternative
+        vector<char> extr_val;   // extreme values of each alternative
+        vector<double> values;
+        tItemSet missing;        // items without the character
+    };
+    tItemMatrix(void)  { nbitems = 0; }
+    void clear(void)  { columns.clear();  nbitems = 0; }
+    int is_built(void) const  { return !columns.empty(); }
+    int get_chars_nb(void) const  { return columns.size(); }
+    int get_items_nb(void) const  { return nbitems; }
+    const tColumn & get_column(int charnum) const  { return columns[charnum-1]; }
+    // Test if an item is matching with values (see tDeltaItemList::matches)
+    int matches(int itemnum, int charnum, const double *values, int nbval=1,
+                int strict=1, int with_extrval=1) const;
+    // Removes from result the items which are not matching with values
+    void select(int charnum, const double *values, int nbval, tItemSet & result,
+                int strict=1, int with_extrval=1) const;
+  protected :
+    friend class tDeltaItemList;
+    vector<tColumn> columns;  // columns[charnum-1]
+    int nbitems;
+    int cell_matches(const tColumn & col, int itemnum, const double *values,
+                     int nbval, int strict, int with_extrval) const;
+};
+
+//--- Identification criterion : a character and its value(s) -------
+class tCriterion {
+  public :
+    tCriterion(void)  { charnum = 0; }
+    tCriterion(int c, double value)  { charnum = c;  values.push_back(value); }
+    tCriterion(int c, double *val, int nbval)  { charnum = c;  values.assign(val, val+nbval); }
+    int charnum;
+    vector<double> values;
+    bool operator < (const tCriterion & cr) const
+      { return (charnum < cr.charnum) || ((charnum == cr.charnum) && (values < cr.values)); }
+};
+
+// Specimen description : list of criteria, all of them must be matched
+typedef vector<tCriterion> tSpecimen;
+
+//--- Cursor of a matching items search -----------------------------
+//      Owned by the caller, so that several threads may browse the same
+//      item list at the same time (see tDeltaItemList::first_matching)
+class tMatchCursor {
+  public :
+    tMatchCursor(void)  { itemnum = 0; }
+    int itemnum;  // last matching item number (0=none)
 };
 
+class tItemVisitor;
+
 //--- Delta item list class -----------------------------------------
 class tDeltaItemList {
   public :
@@ -177,19 +504,43 @@ class tDeltaItemList {
          // fname = name of Delta character list file
          // parse = immediate parsing indicator
     // Destructor
-    ~tDeltaItemList(void)  { delete fitems; }
+    ~tDeltaItemList(void);
     // Reading and parsing the item list file
     //    return value : 1=ok 0=error
     int parse_items(void);
     // Set or change the item list file
     void set_filename(const char *fname, int parse=1);
+    // Arena allocation (off by default) : item descriptions are allocated in
+    // large memory blocks (one series per parsing thread), which are released
+    // all at once when the list is destroyed or parsed again
+    void set_arena(int on)  { use_arena = on; }
+    // Lazy parsing (off by default) : the alternatives of the attributes are
+    // decoded at their first use (see tAttrDescr), so that a list read only
+    // through get_attribute() is never decoded. With arenas, the decoded
+    // alternatives are copied into the arena of their block under a lock
+    // shared by the block : queries from several threads on a list which is
+    // not decoded yet contend on it (decoding itself is not serialized).
+    void set_lazy(int on)  { lazy = on; }
+    // Number of threads used for parsing (1=default; 0=number of processors)
+    //   When the file is memory-mapped, items are parsed in parallel by
+    //   splitting the file at item beginnings (lines beginning with '#')
+    void set_threads(int n)  { threads = n; }
+    // Declared number of items (see tDeltaSpecs::get_declared_items_nb),
+    // used to pre-size the list when it is plausible for the file size
+    void set_declared_items(int n)  { decl_items = n; }
+    // Parse cache directory (empty = no cache; see tParseCache)
+    void set_cache(const char *dir)  { cache_dir = dir ? dir : ""; }
     //--- Member functions returning item list information
-    const char * get_filename(void);
-    int is_parsed(void)  { return parsed; }
-    int get_items_nb(void);
-    string get_item_name(int itemnum, int comment=1);
-    int get_attributes_nb(int itemnum);
-    string get_attribute(int itemnum, int attrnum);
+    //      Const member functions don't modify the item list : once parsed
+    //      (and indexed), it may be queried by several threads without locks
+    const char * get_filename(void) const;
+    int is_parsed(void) const  { return parsed; }
+    int get_items_nb(void) const;
+    // Directives of the file (see tDirectiveTable)
+    const tDirectiveTable & get_directives(void) const  { return dir_table; }
+    string get_item_name(int itemnum, int comment=1) const;
+    int get_attributes_nb(int itemnum) const;
+    string get_attribute(int itemnum, int attrnum) const;
     //--- Functions for identification :
     //      Test if given value(s) are matching with item attributes
     //      (see tAltDescr::compare for information about parameters)
@@ -199,36 +550,200 @@ class tDeltaItemList {
     // Next item matching with values
     int next_matching(int charnum, double *values, int nbval=1, int strict=1,
                       int with_extrval=1);   // returns item number or 0 if not found
+    // Same searches, the last matching item being kept in a caller's cursor
+    int first_matching(tMatchCursor & cursor, int charnum, const double *values,
+                       int nbval=1, int strict=1, int with_extrval=1) const;
+    int next_matching(tMatchCursor & cursor, int charnum, const double *values,
+                      int nbval=1, int strict=1, int with_extrval=1) const;
     // Test if a given item is matching with values
-    int matches(int itemnum, int charnum, double *values, int nbval=1,
-                int strict=1, int with_extrval=1); // returns 1 if matching, 0 elsewhere
+    int matches(int itemnum, int charnum, const double *values, int nbval=1,
+                int strict=1, int with_extrval=1) const; // returns 1 if matching, 0 elsewhere
+    // Removes attributes of excluded characters and renumbers the remaining ones
+    //    charmap[old number] = new number (0=excluded)
+    void renumber_characters(const vector<int> &charmap);
+    //--- Streaming : the items are read one by one and passed to a visitor
+    //      (see tItemVisitor), without being kept in the list, so that the
+    //      memory used doesn't depend on the number of items. The list itself
+    //      is not changed (it may be parsed or not).
+    //    charmap = renumbering applied to each item (see renumber_characters)
+    //    return value : number of items read, -1 if error
+    int stream_items(tItemVisitor & visitor, const vector<int> *charmap=NULL);
+    //--- Identification indexes
+    // Inverted index of multistate characters : for each multistate
+    // character (CT_UM, CT_OM) and each state, the set of matching items
+    int build_state_index(tDeltaCharList *chars);
+    // Interval index of numeric characters (CT_IN, CT_RN) : item values and
+    // ranges, searched by value
+    int build_range_index(tDeltaCharList *chars);
+    // Builds (or rebuilds) both indexes
+    //    return value : number of indexed characters
+    int build_indexes(tDeltaCharList *chars);
+    void clear_indexes(void)  { state_index.clear();  range_index.clear(); }
+    int is_indexed(void) const  { return !(state_index.empty() && range_index.empty()); }
+    int has_index(int charnum) const;
+    // Items matching a value of an indexed character (same result as matches()
+    // for each item, with this unique value)
+    //    return value : 1=ok, 0=character or value not indexed
+    int matching_items(int charnum, double value, tItemSet & result, int strict=1,
+                       int with_extrval=1) const;
+    //--- Item x character matrix (see tItemMatrix)
+    //      When built, it is used by identify() for the criteria which are
+    //      not resolved by the indexes
+    //      return value : number of characters
+    int build_matrix(tDeltaCharList *chars);
+    void clear_matrix(void)  { matrix.clear(); }
+    const tItemMatrix & get_matrix(void) const  { return matrix; }
+    //--- Identification of specimens
+    //      Items matching all the criteria of a specimen description; indexes
+    //      are used when available (see tAltDescr::compare for parameters)
+    //      return value : number of remaining items
+    int identify(const tSpecimen & specimen, tItemSet & result, int strict=1,
+                 int with_extrval=1) const;
+    // Identification of several specimens : item sets of the indexed criteria
+    // are evaluated only once for all the specimens
+    //      return value : number of specimens identified (one remaining item)
+    int identify(const vector<tSpecimen> & specimens, vector<tItemSet> & results,
+                 int strict=1, int with_extrval=1) const;
+    // Same identifications, the criteria on inapplicable characters being
+    // ignored (see tDeltaSpecs::inapplicable_chars)
+    //    inapplicable = set of character numbers (one per specimen)
+    int identify(const tSpecimen & specimen, const tItemSet & inapplicable,
+                 tItemSet & result, int strict=1, int with_extrval=1) const;
+    int identify(const vector<tSpecimen> & specimens,
+                 const vector<tItemSet> & inapplicable, vector<tItemSet> & results,
+                 int strict=1, int with_extrval=1) const;
     //--- For debuging
     void retrieve_all(void);
   protected :
+    friend class tDeltaSnapshot;
+    friend class tItemView;
     tDeltaFile *fitems;
     //--- Delta item description class
     class tItemDescr {
       public :
+        typedef pmr::polymorphic_allocator<char> allocator_type;
         tItemDescr(void)  { }
-        string name;
-        string comment;
-        vector <tAttrDescr> attributes;
+        explicit tItemDescr(const allocator_type & a)
+          : name(a), comment(a), attributes(a), char_index(a)  { }
+        tItemDescr(const tItemDescr & id) : tItemDescr(id, id.get_allocator())  { }
+        tItemDescr(const tItemDescr & id, const allocator_type & a)
+          : name(id.name, a), comment(id.comment, a), attributes(id.attributes, a),
+            char_index(id.char_index, a)  { }
+        tItemDescr(tItemDescr && id) = default;
+        tItemDescr & operator = (const tItemDescr & id) = default;
+        tItemDescr & operator = (tItemDescr && id) = default;
+        allocator_type get_allocator(void) const  { return name.get_allocator(); }
+        pmr::string name;
+        pmr::string comment;
+        pmr::vector <tAttrDescr> attributes;
+        pmr::vector <int> char_index;  // attribute positions sorted by character number
+                                       // (empty if attributes are already sorted)
+        // Builds the character index (after any change of attributes list)
+        void build_index(void);
+        // Position of a character in attributes list (-1 if not found)
+        int find_attribute(int charnum) const;
         // Search a character in attributes list and make value(s) comparison
-        int matches(int charnum, double *values, int nbval=1, int strict=1,
-                    int with_extrval=1);
+        int matches(int charnum, const double *values, int nbval=1, int strict=1,
+                    int with_extrval=1) const;
+    };
+    //--- Parsing context (one for each parsing thread)
+    class tParseCtx {
+      public :
+        tParseCtx(tDeltaFile *f, pmr::memory_resource *mr)
+          : id(tItemDescr::allocator_type(mr))
+          { file = f;  nbitems = 0;  visitor = NULL;  charmap = NULL;  stopped = 0;  more = 0; }
+        tDeltaFile *file;  // file (or file block) being parsed
+        int more;          // another block follows (its first line is an item)
+        tItemDescr id;     // current item
+        int nbitems;       // number of items read
+        vector<string> directives;
+        // Streaming (see stream_items)
+        tItemVisitor *visitor;        // items passed to the visitor (NULL=stored)
+        const vector<int> *charmap;   // renumbering of the items passed
+        int stopped;                  // stop requested by the visitor
+        // Scratch buffers, reused from one item to the next
+        string nbuf;     // item name
+        string abuf;     // attributes list (attributes are cut in place)
+        string pbuf;     // attribute parsing
+    };
+    //--- Index of a multistate character
+    class tStateIndex {
+      public :
+        tStateIndex(void)  { }
+        vector<tItemSet> states;     // states[s-1] = items matching state s
+        vector<tItemSet> states_ne;  // same without extreme values
+                                     // (empty if no difference)
+        tItemSet unknown;  // items with UNKNOWN value or without the character
+    };
+    //--- Index of a numeric character
+    class tRangeIndex {
+      public :
+        tRangeIndex(void)  { indexed = 0; }
+        int indexed;
+        tIntervalIndex ranges;     // values and ranges
+        tIntervalIndex ranges_ne;  // same without extreme values
+        tItemSet variable;  // items with VARIABLE value
+        tItemSet unknown;   // items with UNKNOWN value or without the character
     };
-    tItemDescr id;
+    vector<pmr::monotonic_buffer_resource *> arenas;
+    int use_arena;
+    int lazy;
     vector<tItemDescr> item_list;
+    vector<tStateIndex> state_index;  // state_index[charnum-1]
+    vector<tRangeIndex> range_index;  // range_index[charnum-1]
+    tItemMatrix matrix;
     vector<string> directives;
-    string str;
+    tDirectiveTable dir_table;
+    string cache_dir;
     int parsed;   // file parsing flag
     int nbitems;  // number of items
-    int last_matching;  // last item number matching with character value(s)
-                        // after first_matching() or next_matching() call.
-    int read_directive(char *cline, char * & p1);
-    int read_item(char *cline, char * & p1);
-    int read_attributes(char *cline, char * & p1);
-    int extract_attributes(char *attrlst);
+    int decl_items;  // declared number of items (0=unknown)
+    int threads;  // number of parsing threads
+    tMatchCursor last_matching;  // last item matching with character value(s)
+                                 // after first_matching() or next_matching() call.
+    int identify_items(const tSpecimen & specimen, const tItemSet * inapplicable,
+                       tItemSet & result, int strict, int with_extrval,
+                       map<tCriterion, tItemSet> * cache) const;
+    pmr::memory_resource * new_arena(long size);
+    void free_arenas(void);
+    void save_cache(tParseCache & cache);
+    int load_cache(tParseCache & cache);
+    int parse_block(tParseCtx & ctx, vector<tItemDescr> & list);
+    void store_item(tParseCtx & ctx, vector<tItemDescr> & list);
+    int parse_parallel(int nbthreads);
+    int read_directive(tParseCtx & ctx, const char * & p1, const char * & eol);
+    int read_item(tParseCtx & ctx, const char * & p1, const char * & eol);
+    int read_attributes(tParseCtx & ctx, const char * & p1, const char * & eol);
+    int extract_attributes(tParseCtx & ctx, char *attrlst, char *end);
+      // (attributes are cut in place in [attrlst, end[)
+};
+
+//--- Item read by a streaming (see tDeltaItemList::stream_items) ---
+//      Valid only during the call of the visitor. Same information as
+//      the tDeltaItemList member functions of the same names.
+class tItemView {
+  public :
+    tItemView(int n, const tDeltaItemList::tItemDescr & id) : item(id)  { itemnum = n; }
+    int get_itemnum(void) const  { return itemnum; }
+    string get_item_name(int comment=1) const;
+    int get_attributes_nb(void) const  { return item.attributes.size(); }
+    string get_attribute(int attrnum) const;
+    const tAttrDescr & get_attr(int attrnum) const  { return item.attributes[attrnum-1]; }
+    int matches(int charnum, const double *values, int nbval=1, int strict=1,
+                int with_extrval=1) const
+      { return item.matches(charnum, values, nbval, strict, with_extrval); }
+  protected :
+    int itemnum;
+    const tDeltaItemList::tItemDescr & item;
+};
+
+//--- Visitor of a streaming ----------------------------------------
+class tItemVisitor {
+  public :
+    virtual ~tItemVisitor(void)  { }
+    // Called for each item, in the file order
+    //    return value : 1=continue 0=stop the reading
+    virtual int visit(const tItemView & item) = 0;
 };
 
 
@@ -246,14 +761,35 @@ class tDeltaSpecs {
     // Reading and parsing the specifications file
     //    return value : 1=ok 0=error
     int parse_specs(void);
+    // Reading the specifications list only : the declared sizes are then
+    // known before the characters and items are parsed. parse_specs() uses
+    // the list read, instead of reading it again.
+    //    return value : 1=ok 0=error
+    int read_specs(void);
     // Set or change the specifications file
     void set_filename(const char *fname, int parse=1);
+    // Parse cache directory (empty = no cache; see tParseCache)
+    //   Only the specifications list is stored : specifications are applied
+    //   to the characters list after loading it
+    void set_cache(const char *dir)  { cache_dir = dir ? dir : ""; }
     //--- Member functions returning specifications information
     const char * get_filename(void);
     int is_parsed(void)  { return parsed; }
+    // Directives of the file (see tDirectiveTable)
+    const tDirectiveTable & get_directives(void) const  { return dir_table; }
+    // Declared sizes (0=not declared)
+    int get_declared_chars_nb(void) const
+      { return dir_table.get_int("NUMBER OF CHARACTERS"); }
+    int get_declared_items_nb(void) const
+      { return dir_table.get_int("MAXIMUM NUMBER OF ITEMS"); }
+    // Declared numbers of states (*NUMBERS OF STATES, or else *MAXIMUM NUMBER
+    // OF STATES) : nbstates[charnum-1] (empty if nothing is declared)
+    //    maxchars = plausible number of characters (e.g. from the file size);
+    //               declarations beyond it are ignored
+    void get_declared_states(vector<int> & nbstates, int maxchars) const;
     int get_implicit_value(int charnum, int iv_type=1);  // iv_type 1/2 --> returns iv1 or iv2
     // Retrieving informations about character dependencies
-    //    ccnum, ccstate = control character number and state
+    //    ccnum, ccstate = control character number and state (any state number)
     int get_depchar_nb(int ccnum, int ccstate);  // returns number of dependent characters
     int get_depchar(int ccnum, int ccstate, int rank=1);
         // returns the 'rank' dependent character
@@ -262,28 +798,51 @@ class tDeltaSpecs {
         // test if the 'dcnum' character is
         // dependent from control character 'ccnum' with state 'ccstate'
         // return value : 1=true, 0=false
+    const tItemSet * get_depchars(int ccnum, int ccstate);
+        // returns the dependent characters (NULL if none), as a set of
+        // character numbers browsed with first() and next()
+    int inapplicable_chars(const tSpecimen & specimen, tItemSet & inapplicable);
+        // characters made inapplicable by a specimen description : those
+        // depending on a control character for all its values in the
+        // specimen, then the characters depending on them (recursively)
+        // 'inapplicable' = set of character numbers
+        // return value : number of inapplicable characters
+    // Removes excluded characters from implicit values and dependencies
+    //    charmap[old number] = new number (0=excluded)
+    void renumber_characters(const vector<int> &charmap);
     // For debuging
     void retrieve_all(void);
   protected :
+    friend class tDeltaSnapshot;
     struct tImplVal {
       int iv1;  // Implicit value if character not specified in an item
       int iv2;  // Implicit value if character appears without a value in an item (optional)
     };
     struct tCharDep {
       int cc;    // Control character number
-      int st;    // Control character states
+      vector<int> st;  // Control character states (sorted, no limit)
       int dcnb;  // Number of dependent characters
-      char *dc;  // Dependent characters
+      tItemSet dc;  // Dependent characters
     };
     int parse_specs_detail(void);
     void parse_char_types(const char *ch);
     void parse_implicit_values(const char *ch);
     void parse_char_dependencies(const char *ch);
     tDeltaFile *fspecs;
+    string sbuf;  // scratch buffer (reused from one specification to the next)
     vector<string> specs_list;
+    tDirectiveTable dir_table;
+    string cache_dir;
+    void save_cache(tParseCache & cache);
+    int load_cache(tParseCache & cache);
     int parsed;   // file parsing flag
+    int listed;   // specifications list read by read_specs(), not yet parsed
     tImplVal *impl_val;   // Implicit value table
     vector<tCharDep> char_dep;  // Character dependencies list
+    vector< vector<int> > dep_index;  // dep_index[cc-1][state-1] = dependency
+                                      // (rank in char_dep + 1; 0=none)
+    void index_dependencies(void);
+    const tCharDep * find_dep(int ccnum, int ccstate, const char *caller);
     // Pointers to characters and items list associeted with the specifications
     tDeltaCharList *chars;
     tDeltaItemList *items;
@@ -294,17 +853,168 @@ class tDeltaSpecs {
 //        including characters and items descriptions and specifications
 class tDelta {
   public :
-    tDelta(void)  { chars = NULL;  items = NULL;  specs = NULL; }
+    tDelta(void)  { chars = NULL;  items = NULL;  specs = NULL;  parse_time = 0; }
     tDelta(const char *chars_fname, const char *items_fname, int parse=1);
     tDelta(const char *chars_fname, const char *items_fname,
            const char *specs_fname, int parse=1);
       // .._fname = name of Delta characters, items list and specs files
-      // parse = immediate parsing indicator
+      // parse = immediate parsing indicator, with options (see PARSE_...)
     ~tDelta(void);
+    // Parsing of the files (if not done by the constructor)
+    //    options = see PARSE_...
+    //    return value : 1=ok 0=error
+    int parse(int options=PARSE_NOW);
+    // Parse cache directory for the three files (see tParseCache)
+    void set_cache(const char *dir);
+    // Key of the dataset files contents (see tParseCache::file_key)
+    //    return value : 0 if a file can't be hashed
+    unsigned long long get_key(void);
+    // Excludes characters from the whole dataset (characters, items and
+    // specifications) and renumbers the remaining characters
+    //    excluded = numbers of the characters to exclude
+    //    return value : number of remaining characters
+    int exclude_characters(const vector<int> &excluded);
+    // Streaming of the items file (see tDeltaItemList::stream_items); the
+    // characters excluded so far are removed from the items passed
+    //    return value : number of items read, -1 if error
+    int stream_items(tItemVisitor & visitor);
+    // Identification of specimens (see tDeltaItemList::identify), taking
+    // the character dependencies into account : criteria on characters made
+    // inapplicable by the specimen are not compared
+    //    inapplicable = characters made inapplicable (optional), which need
+    //                   not be asked for
+    int identify(const tSpecimen & specimen, tItemSet & result, int strict=1,
+                 int with_extrval=1, tItemSet *inapplicable=NULL);
+    int identify(const vector<tSpecimen> & specimens, vector<tItemSet> & results,
+                 int strict=1, int with_extrval=1);
+    // Wall-clock time of the parsing done by the constructor (seconds)
+    double get_parse_time(void)  { return parse_time; }
+    // Saves the parsed dataset as a binary snapshot (see tDeltaSnapshot)
+    //    return value : 1=ok 0=error
+    int save_snapshot(const char *fname);
     tDeltaCharList *chars;
     tDeltaItemList *items;
     tDeltaSpecs *specs;
   protected :
+    double parse_time;
+    vector<int> file_charmap;  // renumbering from the file character numbers
+                               // after exclusions (empty=none)
+    void load(const char *chars_fname, const char *items_fname,
+              const char *specs_fname, int parse);
+};
+
+
+//----- Binary snapshot of a parsed dataset -----------------------------------
+//        A snapshot holds the parsed characters, items (with the values of
+//        their alternatives), implicit values and character dependencies.
+//        It is loaded by mapping the file in memory : nothing is rebuilt,
+//        the accessors read the mapping directly. A snapshot can only be
+//        read on a machine with the same byte order as the writer's one.
+#define SNAPSHOT_VERSION 3
+
+class tDeltaSnapshot {
+  public :
+    tDeltaSnapshot(void);
+    tDeltaSnapshot(const char *fname);
+    ~tDeltaSnapshot(void)  { close(); }
+    // Writes a parsed dataset (tDelta::save_snapshot)
+    //    return value : 1=ok 0=error
+    static int save(tDelta & delta, const char *fname);
+    // Loads a snapshot (the file is checked, but not copied)
+    //    return value : 1=ok 0=error (bad format or version)
+    int open(const char *fname);
+    void close(void);
+    int is_open(void) const  { return hdr != NULL; }
+    //--- Characters (see tDeltaCharList)
+    int get_chars_nb(void) const;
+    int get_char_type(int charnum) const;
+    const char * get_char_feature(int charnum) const;
+    const char * get_char_unit(int charnum) const;
+    int get_states_nb(int charnum) const;
+    const char * get_state(int charnum, int statenum) const;
+    //--- Items (see tDeltaItemList)
+    int get_items_nb(void) const;
+    const char * get_item_name(int itemnum) const;  // name with comments
+    string get_item_name(int itemnum, int comment) const;
+    int get_attributes_nb(int itemnum) const;
+    string get_attribute(int itemnum, int attrnum) const;
+    int matches(int itemnum, int charnum, const double *values, int nbval=1,
+                int strict=1, int with_extrval=1) const;
+    //--- Specifications (see tDeltaSpecs)
+    int has_specs(void) const;
+    int get_implicit_value(int charnum, int iv_type=1) const;
+    int get_depchar_nb(int ccnum, int ccstate) const;
+    int get_depchar(int ccnum, int ccstate, int rank=1) const;
+    int is_dependent(int dcnum, int ccnum, int ccstate) const;
+  protected :
+    //--- File layout : header, then sections (8 bytes aligned)
+    enum { S_CHARS, S_STATES, S_ITEMS, S_ATTRS, S_ATTR_ORDER, S_ALTS, S_VALUES,
+           S_IMPL_VAL, S_DEPS, S_DEP_FIRST, S_DEP_INDEX, S_STRINGS, S_NB };
+    struct tHeader {
+      char magic[8];
+      int version;
+      int byte_order;  // 0x01020304 written in the machine byte order
+      int has_specs;
+      int reserved;
+      long long offset[S_NB];  // sections position in the file
+      int count[S_NB];         // number of records of each section
+    };
+    // Strings are given by their position in the strings section
+    struct tChar {
+      unsigned feature, unit;
+      int char_type;
+      unsigned first_state;  // position in states section
+      int nbstates;
+    };
+    struct tItem {
+      unsigned name;
+      unsigned first_attr;  // position in attributes (and attributes order) section
+      int nbattr;
+    };
+    struct tAttr {
+      int charnum;
+      unsigned comment, alt;
+      unsigned first_alt;  // position in alternatives section
+      int nbalt;
+    };
+    struct tAlt {
+      unsigned comment;
+      unsigned first_value;  // position in values section
+      unsigned nbvalues;
+      char val_rel;
+      char extr_val;
+    };
+    struct tImplVal {
+      int iv1, iv2;
+    };
+    struct tDep {
+      int cc, dcnb;
+      unsigned dc;  // dependent characters ('1' = dependent), one per character
+    };
+    // Dependencies lookup (see tDeltaSpecs::dep_index) : the dependency of
+    // control character cc and state st is dep_index[dep_first[cc-1] + st-1]
+    // (rank in dependencies section + 1; 0=none), for st up to
+    // dep_first[cc] - dep_first[cc-1]
+    const tHeader *hdr;
+    const tChar *char_tab;
+    const unsigned *state_tab;
+    const tItem *item_tab;
+    const tAttr *attr_tab;
+    const unsigned *attr_order;  // for each item, attributes sorted by character
+    const tAlt *alt_tab;
+    const double *value_tab;
+    const tImplVal *iv_tab;
+    const tDep *dep_tab;
+    const unsigned *dep_first;
+    const int *dep_index;
+    const char *strings;
+    void *map_addr;  // mapping address
+    char *buf;       // file contents (if the file could not be mapped)
+    long size;       // file size
+    static int record_size(int section);
+    int check(void);
+    int find_attribute(const tItem & it, int charnum) const;
+    const tDep * find_dep(int ccnum, int ccstate) const;
 };
 
 
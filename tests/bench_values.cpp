@@ -0,0 +1,176 @@
+//==============================================================================
+//
+// Microbenchmark of the numeric parsing of the alternatives
+//
+// Value-heavy alternatives (values lists, ranges, extreme values) are
+// generated and parsed by tAltDescr::parse_alternative, and by the former
+// parsing (atof, then rescan of the digits) given here for comparison.
+// The throughput is printed in MB/s of alternatives text.
+//
+// Build and run (from this directory) :
+//    g++ -O2 -pthread -I.. bench_values.cpp ../tdelta.cpp ../tfile.cpp -o bench_values
+//    ./bench_values [number_of_alternatives [passes]]
+//    return value : 0=same values as the former parsing, 1=differences
+//
+//==============================================================================
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <iostream>
+#include <chrono>
+#include <random>
+#include "tdelta.h"
+
+using namespace std;
+
+//--- Former parsing of an alternative (atof + rescans) -----------------------
+class tFormerAlt {
+  public :
+    vector<double> values;
+    char val_rel;
+    int extr_val;
+    int parse(const char *altstr);
+};
+
+int tFormerAlt::parse(const char *altstr)
+{
+  const char *p1 = altstr;
+
+  values.clear();
+  val_rel = 0;
+  extr_val = 0;
+  switch (*p1) {
+    case 'V' : values.push_back(VARIABLE);  return 1;
+    case 'U' : values.push_back(UNKNOWN);   return 1;
+    case '-' : values.push_back(NOTAPPLI);  return 1;
+  }
+  if (*p1 == '(') {   // low extreme value
+    p1++;
+    values.push_back(atof(p1));
+    extr_val = EXTRVAL_LOW;
+    val_rel = '-';
+    while (*p1 && (*p1 != ')'))
+      p1++;
+    if (*p1 == ')')
+      p1++;
+    if (!*p1)
+      return 0;
+  }
+  values.push_back(atof(p1));
+  while (*p1 && (*p1 != '-') && (*p1 != '&') && (*p1 != '('))
+    p1++;
+  if (!*p1)
+    return 1;
+  if (*p1 != '(')
+    val_rel = *p1++;
+  while (*p1) {
+    if (*p1 == '(') {   // high extreme value
+      p1++;
+      if (*p1)
+        p1++;
+      values.push_back(atof(p1));
+      extr_val |= EXTRVAL_HIGH;
+      val_rel = '-';
+      break;
+    }
+    values.push_back(atof(p1));
+    while (*p1 && (*p1 != val_rel) && (*p1 != '('))
+      p1++;
+    if (*p1 == val_rel)
+      p1++;
+  }
+  return 1;
+}
+
+//--- Generation of the alternatives ------------------------------------------
+static string number(mt19937 & g)
+{
+  char buf[32];
+
+  switch (g() % 4) {
+    case 0 :  snprintf(buf, sizeof(buf), "%d", (int) (g() % 1000));  break;
+    case 1 :  snprintf(buf, sizeof(buf), "%.2f", (g() % 100000) / 100.0);  break;
+    case 2 :  snprintf(buf, sizeof(buf), "%.1f", (g() % 1000) / 10.0);  break;
+    default : snprintf(buf, sizeof(buf), ".%d", (int) (g() % 100));  break;
+  }
+  return buf;
+}
+
+// Values list, range, or range with extreme values
+static string alternative(mt19937 & g)
+{
+  string s;
+  int i;
+
+  switch (g() % 5) {
+    case 0 :
+      s = number(g);
+      for (i=g()%6; i>0; i--)
+        s += "&" + number(g);
+      return s;
+    case 1 :  return number(g) + "-" + number(g);
+    case 2 :  return "(" + number(g) + "-)" + number(g) + "-" + number(g) + "(-" + number(g) + ")";
+    case 3 :  return number(g) + "-" + number(g) + "(-" + number(g) + ")";
+    default : return "(" + number(g) + "-)" + number(g);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  vector<string> alts;
+  tAltDescr ad;
+  tFormerAlt fa;
+  mt19937 g(7);
+  double sum, t1, t2;
+  long bytes, diffs;
+  int nbalts, passes, i, j, r;
+  chrono::steady_clock::time_point t0;
+
+  nbalts = (argc > 1) ? atoi(argv[1]) : 1000000;
+  passes = (argc > 2) ? atoi(argv[2]) : 5;
+  //--- Value-heavy alternatives (more than 6 characters)
+  bytes = 0;
+  while (alts.size() < nbalts) {
+    string s = alternative(g);
+    if (s.size() > 6) {
+      bytes += s.size();
+      alts.push_back(s);
+    }
+  }
+  //--- Same values as the former parsing
+  diffs = 0;
+  for (i=0; i<alts.size(); i++) {
+    r = (fa.parse(alts[i].c_str()) == ad.parse_alternative(alts[i].data(), alts[i].data() + alts[i].size()))
+        && (fa.values.size() == ad.get_values_nb()) && (fa.val_rel == ad.get_val_rel())
+        && (fa.extr_val == ad.get_extr_val());
+    for (j=0; r && (j<fa.values.size()); j++)
+      r = (fa.values[j] == ad.get_value(j+1));
+    if (!r)
+      diffs++;
+  }
+  //--- Timings
+  sum = 0;
+  t0 = chrono::steady_clock::now();
+  for (r=0; r<passes; r++)
+    for (i=0; i<alts.size(); i++) {
+      fa.parse(alts[i].c_str());
+      sum += fa.values.size();
+    }
+  t1 = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+  t0 = chrono::steady_clock::now();
+  for (r=0; r<passes; r++)
+    for (i=0; i<alts.size(); i++) {
+      ad.parse_alternative(alts[i].data(), alts[i].data() + alts[i].size());
+      sum += ad.get_values_nb();
+    }
+  t2 = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+  cout << alts.size() << " alternatives (" << (long) (sum / passes / 2) << " values), "
+       << bytes / 1e6 << " MB, " << passes << " passes" << endl;
+  cout << "  atof + rescans     " << (int) (t1 * 1000) << " ms  "
+       << (int) (bytes * passes / 1e6 / t1) << " MB/s" << endl;
+  cout << "  parse_alternative  " << (int) (t2 * 1000) << " ms  "
+       << (int) (bytes * passes / 1e6 / t2) << " MB/s" << endl;
+  cout << diffs << " differences with the former parsing" << endl;
+  return diffs ? 1 : 0;
+}
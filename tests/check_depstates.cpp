@@ -0,0 +1,145 @@
+//==============================================================================
+//
+// Check of the character dependencies with many states
+//
+// A controlling character with 45 states (beyond the former sizeof(int)
+// limit) is written in a small dataset; its dependencies are checked in the
+// parsed specifications (tDeltaSpecs) and after a snapshot round-trip
+// (tDeltaSnapshot).
+//
+// Build and run (from this directory) :
+//    g++ -O2 -pthread -I.. check_depstates.cpp ../tdelta.cpp ../tfile.cpp -o check_depstates
+//    ./check_depstates [work_dir]
+//    return value : 0=all checks passed, 1=failure
+//
+//==============================================================================
+
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include "tdelta.h"
+
+using namespace std;
+
+#define NBSTATES 45   // states of the controlling character
+#define NBCHARS  10
+
+static int nbchecks = 0, nbfailed = 0;
+
+// Compares a result with the expected value
+static void check(const char *what, int ccstate, int result, int expected)
+{
+  nbchecks++;
+  if (result != expected) {
+    nbfailed++;
+    cout << "FAILED : " << what << " (state " << ccstate << ") = " << result
+         << ", expected " << expected << endl;
+  }
+}
+
+// Writes the dataset : character 1 has NBSTATES states and controls
+//   characters 2-4 for states 5, 33, 40 and 45
+//   character 5 for state 3
+//   character 9 for state 41
+// character 6 (2 states) controls characters 7-8 for both states
+static int write_dataset(const string & dir)
+{
+  int c, s;
+
+  ofstream chars((dir + "/check_chars").c_str());
+  chars << "*SHOW ~ Dependencies with many states" << endl;
+  chars << "#1. controlling character/" << endl;
+  for (s=1; s<=NBSTATES; s++)
+    chars << "  " << s << ". state " << s << "/" << endl;
+  for (c=2; c<=NBCHARS; c++)
+    chars << "#" << c << ". character " << c << "/" << endl
+          << "  1. present/" << endl << "  2. absent/" << endl;
+  ofstream items((dir + "/check_items").c_str());
+  items << "*ITEM DESCRIPTIONS" << endl;
+  items << "# Taxon one/ 1,40 6,1" << endl;
+  items << "# Taxon two/ 1,2 2,1 3,2 4,1 5,1 6,2" << endl;
+  ofstream specs((dir + "/check_specs").c_str());
+  specs << "*NUMBER OF CHARACTERS " << NBCHARS << endl;
+  specs << "*MAXIMUM NUMBER OF STATES " << NBSTATES << endl;
+  specs << "*NUMBERS OF STATES 1," << NBSTATES << endl;
+  specs << "*DEPENDENT CHARACTERS 1,5/33/40/45:2-4 1,3:5 1,41:9" << endl;
+  specs << "   6,1/2:7-8" << endl;
+  return chars.good() && items.good() && specs.good();
+}
+
+// Expected dependent characters of character 1 for a state (bitmask of
+// character numbers)
+static int expected_1(int ccstate)
+{
+  switch (ccstate) {
+    case 5 : case 33 : case 40 : case 45 : return (1 << 2) | (1 << 3) | (1 << 4);
+    case 3 :  return 1 << 5;
+    case 41 : return 1 << 9;
+    default : return 0;
+  }
+}
+
+// Checks the dependencies through the accessors of tDeltaSpecs or
+// tDeltaSnapshot (same member functions)
+template <class T> static void check_dependencies(T & deps, const char *label)
+{
+  string what;
+  int s, d, r, mask, nb;
+
+  cout << label << endl;
+  for (s=1; s<=NBSTATES+5; s++) {
+    mask = expected_1(s);
+    nb = 0;
+    for (d=1; d<=NBCHARS; d++)
+      if (mask & (1 << d))
+        nb++;
+    check("get_depchar_nb(1)", s, deps.get_depchar_nb(1, s), nb);
+    // dependent characters in increasing order, then 0
+    r = 1;
+    for (d=1; d<=NBCHARS; d++)
+      if (mask & (1 << d))
+        check("get_depchar(1)", s, deps.get_depchar(1, s, r++), d);
+    check("get_depchar(1) beyond the last", s, deps.get_depchar(1, s, r), 0);
+    for (d=1; d<=NBCHARS; d++)
+      check("is_dependent(1)", s, deps.is_dependent(d, 1, s), (mask >> d) & 1);
+  }
+  // Few-state controlling character
+  for (s=1; s<=2; s++) {
+    check("get_depchar_nb(6)", s, deps.get_depchar_nb(6, s), 2);
+    check("get_depchar(6)", s, deps.get_depchar(6, s, 2), 8);
+    check("is_dependent(6)", s, deps.is_dependent(7, 6, s), 1);
+  }
+  check("get_depchar_nb(6)", 3, deps.get_depchar_nb(6, 3), 0);
+}
+
+int main(int argc, char **argv)
+{
+  string dir = (argc > 1) ? argv[1] : ".";
+  string snapshot = dir + "/check_snapshot";
+
+  if (!write_dataset(dir)) {
+    cout << "Unable to write the dataset in " << dir << endl;
+    return 1;
+  }
+  tDelta delta((dir + "/check_chars").c_str(), (dir + "/check_items").c_str(),
+               (dir + "/check_specs").c_str(), PARSE_NOW);
+  if (!delta.specs || !delta.specs->is_parsed() ||
+      (delta.chars->get_states_nb(1) != NBSTATES)) {
+    cout << "Error parsing the dataset" << endl;
+    return 1;
+  }
+  check_dependencies(*delta.specs, "Parsed specifications");
+  //--- Snapshot round-trip
+  check("tDeltaSnapshot::save", 0, tDeltaSnapshot::save(delta, snapshot.c_str()), 1);
+  tDeltaSnapshot snap(snapshot.c_str());
+  check("tDeltaSnapshot::open", 0, snap.is_open(), 1);
+  if (snap.is_open())
+    check_dependencies(snap, "Snapshot");
+  snap.close();
+  remove((dir + "/check_chars").c_str());
+  remove((dir + "/check_items").c_str());
+  remove((dir + "/check_specs").c_str());
+  remove(snapshot.c_str());
+  cout << nbchecks << " checks, " << nbfailed << " failed" << endl;
+  return nbfailed ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+//==============================================================================
+//
+// Check of the parallel parsing of the items file
+//
+// Items files are parsed with 1 (sequential parsing) to 8 threads; the same
+// files must be accepted, with the same items. Items without attributes are
+// placed everywhere, and in particular at the end of the parallel blocks.
+//
+// Build and run (from this directory) :
+//    g++ -O2 -pthread -I.. check_items.cpp ../tdelta.cpp ../tfile.cpp -o check_items
+//    ./check_items [work_dir]
+//    return value : 0=all checks passed, 1=failure
+//
+//==============================================================================
+
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include "tdelta.h"
+
+using namespace std;
+
+static int nbchecks = 0, nbfailed = 0;
+
+// Compares a result with the expected value
+static void check(const string & what, int result, int expected)
+{
+  nbchecks++;
+  if (result != expected) {
+    nbfailed++;
+    cout << "FAILED : " << what << " = " << result << ", expected " << expected << endl;
+  }
+}
+
+// Parses an items file with a number of threads
+//    return value : value returned by parse_items
+static int parse(const string & fname, int nbthreads, tDeltaItemList & items)
+{
+  items.set_filename(fname.c_str(), 0);
+  items.set_threads(nbthreads);
+  return items.parse_items();
+}
+
+// Parses an items file with 1 to 8 threads and compares with the sequential
+// parsing (expected = value expected from parse_items)
+static void check_file(const string & fname, const string & label, int expected)
+{
+  tDeltaItemList seq(fname.c_str(), 0);
+  int i, n, ok;
+
+  cout << label << endl;
+  check(label + " : sequential parse_items", parse(fname, 1, seq), expected);
+  for (n=2; n<=8; n*=2) {
+    tDeltaItemList par(fname.c_str(), 0);
+    string what = label + " (" + to_string(n) + " threads)";
+    ok = parse(fname, n, par);
+    check(what + " : parse_items", ok, expected);
+    if (!ok || !expected)
+      continue;
+    check(what + " : get_items_nb", par.get_items_nb(), seq.get_items_nb());
+    for (i=1; (i<=seq.get_items_nb()) && (i<=par.get_items_nb()); i++) {
+      check(what + " : name of item " + to_string(i),
+            par.get_item_name(i) == seq.get_item_name(i), 1);
+      check(what + " : get_attributes_nb(" + to_string(i) + ")",
+            par.get_attributes_nb(i), seq.get_attributes_nb(i));
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  string dir = (argc > 1) ? argv[1] : ".";
+  string fname = dir + "/check_items_data";
+  int i;
+
+  //--- Item without attributes between two items
+  {
+    ofstream items(fname.c_str());
+    items << "*ITEM DESCRIPTIONS" << endl;
+    items << "# A/ 1,1" << endl << "# B/" << endl << "# C/ 1,2" << endl;
+  }
+  check_file(fname, "Small file", 1);
+  //--- Items without attributes everywhere (one item in three, not the last)
+  {
+    ofstream items(fname.c_str());
+    items << "*ITEM DESCRIPTIONS" << endl;
+    for (i=1; i<=601; i++) {
+      items << "# Taxon " << i << "/";
+      if (i % 3)
+        items << " 1," << (i % 5 + 1) << " 2," << i << ".5 3,1/2";
+      items << endl;
+    }
+  }
+  check_file(fname, "Large file", 1);
+  //--- Last item without attributes (not accepted)
+  {
+    ofstream items(fname.c_str());
+    items << "*ITEM DESCRIPTIONS" << endl;
+    for (i=1; i<=200; i++)
+      items << "# Taxon " << i << "/" << ((i < 200) ? " 1,1" : "") << endl;
+  }
+  check_file(fname, "Last item without attributes", 0);
+  remove(fname.c_str());
+  cout << nbchecks << " checks, " << nbfailed << " failed" << endl;
+  return nbfailed ? 1 : 0;
+}